@@ -9,6 +9,8 @@
 
 MCP2515 MCP = MCP2515();
 
+void onReceive(const MCP2515CanPaket &packet);
+
 void setup() {
 	Serial.begin(9600);
 	while (!Serial) {
@@ -18,44 +20,45 @@ void setup() {
 	Serial.println("CAN Receiver Callback");
 
 	// start the CAN bus at 50 kbps
-	if (!MCP.begin(50E3)) {
+	if (MCP.begin(MCP2515::CAN_50KBPS)) {
 		Serial.println("Starting CAN failed!");
 		while (true);
 	}
 
-	// register the receive callback
+	// register the receive callback, this attaches the interrupt handler to the INT pin
 	MCP.onReceivePacket(onReceive);
 }
 
 void loop() {
-	// do nothing
+	// the interrupt handler collects the packets, the callback is invoked from here
+	MCP.processRxQueue();
 }
 
-void onReceive(CANPacket* packet) {
+void onReceive(const MCP2515CanPaket &packet) {
 	Serial.print("Received ");
 
-	if (packet->isExtended()) {
+	if (packet.extended()) {
 		Serial.print("extended ");
 	}
 
-	if (packet->getRtr()) {
+	if (packet.rtr()) {
 		// Remote transmission request, packet contains no data
 		Serial.print("RTR ");
 	}
 
 	Serial.print("packet with id 0x");
-	Serial.print(packet->getId(), HEX);
+	Serial.print(packet.id(), HEX);
 
 	// only print packet data for non-RTR packets
-	if (packet->getRtr()) {
+	if (packet.rtr()) {
 		Serial.print(" and requested length ");
-		Serial.println(packet->getDlc());
+		Serial.println(packet.dlc());
 	} else {
 		Serial.print(" and length ");
-		Serial.println(packet->getDlc());
+		Serial.println(packet.dlc());
 
-		for (int i = 0; i < packet->getDlc(); i++) {
-			Serial.print(packet->getData()[i]);
+		for (int i = 0; i < packet.dlc(); i++) {
+			Serial.print(packet.data()[i]);
 		}
 
 		Serial.println();
@@ -0,0 +1,264 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+SPIClass SPI;
+
+namespace host {
+
+namespace {
+
+struct Pin {
+    uint8_t mode{INPUT};
+    uint8_t level{HIGH};
+    void (*isr)(){nullptr};
+    int isrMode{FALLING};
+    bool pending{false};
+};
+
+Costs g_costs;
+SpiStats g_spiStats;
+uint64_t g_nanos{0};
+Pin g_pins[NUM_PINS];
+volatile uint8_t g_ports[NUM_PINS / 8]{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+bool g_interruptsEnabled{true};
+uint8_t g_maskDepth{0};
+bool g_inIsr{false};
+
+} // namespace
+
+Costs &costs() { return g_costs; }
+
+uint64_t nanos() { return g_nanos; }
+
+void advance(uint64_t ns) { g_nanos += ns; }
+
+void setNanos(uint64_t ns) { g_nanos = ns; }
+
+uint8_t pinLevel(uint8_t pin) {
+    if(pin >= NUM_PINS)
+        return HIGH;
+    if(g_pins[pin].mode == OUTPUT)
+        return (g_ports[pin / 8] & (1 << (pin % 8))) ? HIGH : LOW;
+    return g_pins[pin].level;
+}
+
+volatile uint8_t *portRegister(uint8_t port) {
+    return &g_ports[port];
+}
+
+void setPinLevel(uint8_t pin, uint8_t level) {
+    if(pin >= NUM_PINS)
+        return;
+
+    Pin &p = g_pins[pin];
+    uint8_t old = p.level;
+    p.level = level ? HIGH : LOW;
+
+    if(p.isr) {
+        bool falling = (old == HIGH && p.level == LOW);
+        bool rising = (old == LOW && p.level == HIGH);
+        switch(p.isrMode) {
+            case FALLING: p.pending |= falling; break;
+            case RISING: p.pending |= rising; break;
+            case CHANGE: p.pending |= (falling || rising); break;
+            case LOW_LEVEL: p.pending |= (p.level == LOW); break;
+        }
+    }
+    deliverInterrupts();
+}
+
+void deliverInterrupts() {
+    if(!g_interruptsEnabled || g_maskDepth || g_inIsr)
+        return;
+
+    // bounded, so that a level triggered ISR which never clears its source cannot hang the host
+    for(int round = 0; round < 1000; round++) {
+        bool any = false;
+        for(uint8_t i = 0; i < NUM_PINS; i++) {
+            Pin &p = g_pins[i];
+            if(!p.pending || !p.isr)
+                continue;
+
+            p.pending = false;
+            any = true;
+
+            g_inIsr = true;
+            p.isr();
+            g_inIsr = false;
+
+            // a level triggered interrupt fires again as long as the line is held low
+            if(p.isrMode == LOW_LEVEL && p.level == LOW)
+                p.pending = true;
+        }
+        if(!any)
+            return;
+    }
+}
+
+void maskInterrupts(bool mask) {
+    if(mask) {
+        g_maskDepth++;
+    } else if(g_maskDepth) {
+        g_maskDepth--;
+        deliverInterrupts();
+    }
+}
+
+SpiStats &spiStats() { return g_spiStats; }
+
+void reset() {
+    g_costs = Costs{};
+    g_spiStats = SpiStats{};
+    g_nanos = 0;
+    for(auto &p : g_pins)
+        p = Pin{};
+    for(auto &p : g_ports)
+        p = 0xFF;
+    g_interruptsEnabled = true;
+    g_maskDepth = 0;
+    g_inIsr = false;
+}
+
+} // namespace host
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if(pin < host::NUM_PINS)
+        host::g_pins[pin].mode = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    host::advance(host::g_costs.digitalWriteNs);
+    if(pin >= host::NUM_PINS)
+        return;
+    host::g_pins[pin].level = val ? HIGH : LOW;
+    if(val)
+        host::g_ports[pin / 8] |= (1 << (pin % 8));
+    else
+        host::g_ports[pin / 8] &= ~(1 << (pin % 8));
+}
+
+int digitalRead(uint8_t pin) {
+    host::advance(host::g_costs.digitalReadNs);
+    return host::pinLevel(pin);
+}
+
+unsigned long millis() {
+    host::advance(host::g_costs.timeQueryNs);
+    return static_cast<uint32_t>(host::g_nanos / 1000000ULL);
+}
+
+unsigned long micros() {
+    host::advance(host::g_costs.timeQueryNs);
+    return static_cast<uint32_t>(host::g_nanos / 1000ULL);
+}
+
+void delay(unsigned long ms) {
+    host::advance(ms * 1000000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+    host::advance(us * 1000ULL);
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*isr)(), int mode) {
+    if(interruptNum >= host::NUM_PINS)
+        return;
+    auto &p = host::g_pins[interruptNum];
+    p.isr = isr;
+    p.isrMode = mode;
+    p.pending = (mode == LOW_LEVEL && p.level == LOW);
+    host::deliverInterrupts();
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+    if(interruptNum < host::NUM_PINS)
+        host::g_pins[interruptNum].isr = nullptr;
+}
+
+void noInterrupts() {
+    host::g_interruptsEnabled = false;
+}
+
+void interrupts() {
+    host::g_interruptsEnabled = true;
+    host::deliverInterrupts();
+}
+
+void SPIClass::beginTransaction(SPISettings settings) {
+    _settings = settings;
+    _inTransaction = true;
+    host::g_spiStats.transactions++;
+    host::advance(host::g_costs.transactionNs);
+    if(_usingInterrupt)
+        host::maskInterrupts(true);
+    sync();
+}
+
+void SPIClass::endTransaction() {
+    sync();
+    _inTransaction = false;
+    if(_usingInterrupt)
+        host::maskInterrupts(false);
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    host::advance(host::g_costs.byteOverheadNs);
+    return exchange(data);
+}
+
+uint16_t SPIClass::transfer16(uint16_t data) {
+    uint16_t hi = transfer(data >> 8);
+    return (hi << 8) | transfer(data & 0xFF);
+}
+
+void SPIClass::transfer(void *buf, size_t count) {
+    uint8_t *p = static_cast<uint8_t *>(buf);
+    for(size_t i = 0; i < count; i++) {
+        host::advance(host::g_costs.blockByteOverheadNs);
+        p[i] = exchange(p[i]);
+    }
+}
+
+uint8_t SPIClass::exchange(uint8_t data) {
+    sync();
+
+    uint32_t clock = _settings.clock ? _settings.clock : 1;
+    host::advance(8000000000ULL / clock);
+    host::g_spiStats.bytes++;
+
+    for(auto dev : _devices) {
+        if(dev && dev->spiSelected())
+            return dev->spiTransfer(data);
+    }
+    return 0xFF;
+}
+
+void SPIClass::attach(host::SpiDevice *device) {
+    for(auto &dev : _devices) {
+        if(!dev) {
+            dev = device;
+            return;
+        }
+    }
+}
+
+void SPIClass::detach(host::SpiDevice *device) {
+    for(auto &dev : _devices) {
+        if(dev == device)
+            dev = nullptr;
+    }
+}
+
+void SPIClass::sync() {
+    for(auto dev : _devices) {
+        if(dev)
+            dev->spiSync();
+    }
+}
@@ -0,0 +1,686 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+
+#include "MCP2515Sim.h"
+
+// Register map and bit definitions are taken from the datasheet (DS20001801J) on purpose,
+// so that errors in the driver's mcp2515_def.h are not mirrored by the model.
+namespace {
+
+constexpr uint8_t REG_BFPCTRL   = 0x0C;
+constexpr uint8_t REG_TXRTSCTRL = 0x0D;
+constexpr uint8_t REG_CANSTAT   = 0x0E;
+constexpr uint8_t REG_CANCTRL   = 0x0F;
+constexpr uint8_t REG_TEC       = 0x1C;
+constexpr uint8_t REG_REC       = 0x1D;
+constexpr uint8_t REG_RXM0SIDH  = 0x20;
+constexpr uint8_t REG_CNF3      = 0x28;
+constexpr uint8_t REG_CNF1      = 0x2A;
+constexpr uint8_t REG_CANINTE   = 0x2B;
+constexpr uint8_t REG_CANINTF   = 0x2C;
+constexpr uint8_t REG_EFLG      = 0x2D;
+constexpr uint8_t REG_TXB0CTRL  = 0x30;
+constexpr uint8_t REG_RXB0CTRL  = 0x60;
+constexpr uint8_t REG_RXB1CTRL  = 0x70;
+
+constexpr uint8_t CANCTRL_REQOP = 0xE0;
+constexpr uint8_t CANCTRL_ABAT  = 0x10;
+
+constexpr uint8_t MODE_NORMAL   = 0x00;
+constexpr uint8_t MODE_LOOPBACK = 0x40;
+constexpr uint8_t MODE_LISTEN   = 0x60;
+constexpr uint8_t MODE_CONFIG   = 0x80;
+
+constexpr uint8_t TXB_ABTF  = 0x40;
+constexpr uint8_t TXB_MLOA  = 0x20;
+constexpr uint8_t TXB_TXERR = 0x10;
+constexpr uint8_t TXB_TXREQ = 0x08;
+constexpr uint8_t TXB_TXP   = 0x03;
+
+constexpr uint8_t RXB_RXM    = 0x60;
+constexpr uint8_t RXB_RXRTR  = 0x08;
+constexpr uint8_t RXB0_BUKT  = 0x04;
+constexpr uint8_t RXB0_BUKT1 = 0x02;
+
+constexpr uint8_t INTF_RX0IF = 0x01;
+constexpr uint8_t INTF_RX1IF = 0x02;
+constexpr uint8_t INTF_ERRIF = 0x20;
+
+constexpr uint8_t EFLG_RX0OVR = 0x40;
+constexpr uint8_t EFLG_RX1OVR = 0x80;
+
+constexpr uint8_t SIDL_SRR   = 0x10;
+constexpr uint8_t SIDL_EXIDE = 0x08;
+constexpr uint8_t DLC_RTR    = 0x40;
+
+constexpr uint8_t TXB_CTRL(uint8_t n) { return REG_TXB0CTRL + n * 0x10; }
+constexpr uint8_t RXB_CTRL(uint8_t n) { return REG_RXB0CTRL + n * 0x10; }
+
+bool isTxBufferData(uint8_t address) {
+    return address >= 0x31 && address <= 0x5D && (address & 0x0F) >= 0x01 && (address & 0x0F) <= 0x0D;
+}
+
+bool isConfigOnly(uint8_t address) {
+    return address <= 0x0B || (address >= 0x10 && address <= 0x1B) ||
+           (address >= REG_RXM0SIDH && address <= REG_CNF1) || address == REG_TXRTSCTRL;
+}
+
+bool isBitModifiable(uint8_t address) {
+    switch(address) {
+        case REG_BFPCTRL: case REG_TXRTSCTRL: case REG_CANCTRL:
+        case 0x28: case 0x29: case 0x2A: case REG_CANINTE: case REG_CANINTF: case REG_EFLG:
+        case 0x30: case 0x40: case 0x50: case REG_RXB0CTRL: case REG_RXB1CTRL:
+            return true;
+        default:
+            return (address & 0x0F) == REG_CANCTRL;
+    }
+}
+
+} // namespace
+
+bool MCP2515Sim::Frame::operator==(const Frame &o) const {
+    if(id != o.id || extended != o.extended || rtr != o.rtr || dlc != o.dlc)
+        return false;
+    return rtr || memcmp(data, o.data, dlc > 8 ? 8 : dlc) == 0;
+}
+
+MCP2515Sim::MCP2515Sim(SPIClass &spi, uint8_t csPin, int intPin) :
+    _spi(spi),
+    _csPin(csPin),
+    _intPin(intPin)
+{
+    _spi.attach(this);
+    powerOn();
+}
+
+MCP2515Sim::~MCP2515Sim() {
+    _spi.detach(this);
+}
+
+void MCP2515Sim::powerOn() {
+    memset(_regs, 0, sizeof(_regs));
+
+    // acceptance filters and masks are undefined after reset
+    for(uint8_t a = 0x00; a < 0x0C; a++)
+        _regs[a] = 0xA5;
+    for(uint8_t a = 0x10; a < 0x1C; a++)
+        _regs[a] = 0xA5;
+    for(uint8_t a = 0x20; a < 0x28; a++)
+        _regs[a] = 0xA5;
+
+    _regs[REG_CANCTRL] = 0x87;
+    _opMode = _requestedMode = MODE_CONFIG;
+    _modeChangeAt = 0;
+    _state = State::IDLE;
+    _clearOnDeselect = 0;
+    _txRequested = false;
+    updateInt();
+}
+
+uint8_t MCP2515Sim::opMode() {
+    if(_opMode != _requestedMode && host::nanos() >= _modeChangeAt) {
+        _opMode = _requestedMode;
+        _txRequested = true;
+    }
+    return _opMode;
+}
+
+uint8_t MCP2515Sim::reg(uint8_t address) const {
+    address &= 0x7F;
+    if((address & 0x0F) == REG_CANSTAT)
+        return _opMode | (_regs[REG_CANSTAT] & 0x0E);
+    if((address & 0x0F) == REG_CANCTRL)
+        return _regs[REG_CANCTRL];
+    return _regs[address];
+}
+
+uint8_t MCP2515Sim::readReg(uint8_t address) {
+    address &= 0x7F;
+    if((address & 0x0F) == REG_CANSTAT) {
+        // ICOD reports the highest priority pending interrupt
+        static constexpr uint8_t icod[] = {6, 7, 3, 4, 5, 1, 2};
+        static constexpr uint8_t order[] = {5, 6, 2, 3, 4, 0, 1};
+        uint8_t pending = _regs[REG_CANINTF] & _regs[REG_CANINTE];
+        uint8_t code = 0;
+        for(uint8_t bit : order) {
+            if(pending & (1 << bit)) {
+                code = icod[bit];
+                break;
+            }
+        }
+        return opMode() | (code << 1);
+    }
+    return reg(address);
+}
+
+void MCP2515Sim::writeReg(uint8_t address, uint8_t value) {
+    address &= 0x7F;
+
+    if((address & 0x0F) == REG_CANSTAT)
+        return;
+
+    if((address & 0x0F) == REG_CANCTRL) {
+        uint8_t old = _regs[REG_CANCTRL];
+        _regs[REG_CANCTRL] = value;
+        if((value & CANCTRL_REQOP) != (old & CANCTRL_REQOP)) {
+            _requestedMode = value & CANCTRL_REQOP;
+            _modeChangeAt = host::nanos() + _modeSwitchDelayNs;
+            opMode();
+        }
+        if(value & CANCTRL_ABAT) {
+            for(uint8_t n = 0; n < 3; n++) {
+                uint8_t &ctrl = _regs[TXB_CTRL(n)];
+                if(ctrl & TXB_TXREQ)
+                    ctrl = (ctrl & ~TXB_TXREQ) | TXB_ABTF;
+            }
+        }
+        return;
+    }
+
+    if(isConfigOnly(address) && opMode() != MODE_CONFIG) {
+        _violations++;
+        return;
+    }
+
+    if(isTxBufferData(address) && (_regs[address & 0xF0] & TXB_TXREQ)) {
+        _violations++;
+        return;
+    }
+
+    switch(address) {
+        case REG_TEC:
+        case REG_REC:
+            return;
+        case REG_BFPCTRL:
+            _regs[address] = value & 0x3F;
+            updateInt();
+            return;
+        case REG_TXRTSCTRL:
+            _regs[address] = (_regs[address] & 0x07) | (value & 0x38);
+            return;
+        case REG_CANINTE:
+        case REG_CANINTF:
+            _regs[address] = value;
+            updateInt();
+            return;
+        case REG_EFLG:
+            _regs[address] = (_regs[address] & 0x3F) | (value & 0xC0);
+            return;
+        case REG_RXB0CTRL:
+            _regs[address] = (_regs[address] & ~(RXB_RXM | RXB0_BUKT | RXB0_BUKT1)) | (value & (RXB_RXM | RXB0_BUKT));
+            if(value & RXB0_BUKT)
+                _regs[address] |= RXB0_BUKT1;
+            return;
+        case REG_RXB1CTRL:
+            _regs[address] = (_regs[address] & ~RXB_RXM) | (value & RXB_RXM);
+            return;
+        case 0x30:
+        case 0x40:
+        case 0x50: {
+            uint8_t old = _regs[address];
+            uint8_t ctrl = (old & (TXB_ABTF | TXB_MLOA | TXB_TXERR)) | (value & (TXB_TXREQ | TXB_TXP));
+            if((value & TXB_TXREQ) && !(old & TXB_TXREQ)) {
+                ctrl &= ~(TXB_ABTF | TXB_MLOA | TXB_TXERR);
+                _txRequested = true;
+            } else if(!(value & TXB_TXREQ) && (old & TXB_TXREQ)) {
+                ctrl |= TXB_ABTF;
+            }
+            _regs[address] = ctrl;
+            return;
+        }
+        default:
+            break;
+    }
+
+    // receive buffers and unimplemented locations are read only
+    if(address >= 0x60 || (address & 0x0F) >= 0x0E || address == 0x1E || address == 0x1F)
+        return;
+
+    _regs[address] = value;
+}
+
+void MCP2515Sim::bitModify(uint8_t address, uint8_t mask, uint8_t value) {
+    address &= 0x7F;
+    if(!isBitModifiable(address))
+        mask = 0xFF;
+
+    uint8_t cur = reg(address);
+    writeReg(address, (cur & ~mask) | (value & mask));
+}
+
+void MCP2515Sim::spiSync() {
+    bool selected = (host::pinLevel(_csPin) == LOW);
+    if(selected && !_selected)
+        select();
+    else if(!selected && _selected)
+        deselect();
+}
+
+void MCP2515Sim::select() {
+    _selected = true;
+    _state = State::IDLE;
+    _clearOnDeselect = 0;
+}
+
+void MCP2515Sim::deselect() {
+    _selected = false;
+    _state = State::IDLE;
+
+    if(_clearOnDeselect) {
+        _regs[REG_CANINTF] &= ~_clearOnDeselect;
+        _clearOnDeselect = 0;
+        updateInt();
+    }
+
+    if(_autoTransmit)
+        transmitPending();
+}
+
+uint8_t MCP2515Sim::spiTransfer(uint8_t data) {
+    uint8_t out = 0x00;
+
+    // still in reset, only a read does no harm
+    if(host::nanos() < _readyAt) {
+        if(_state == State::IDLE && data != 0x03 && data != 0xA0 && data != 0xB0)
+            _violations++;
+        _state = State::DONE;
+        return 0xFF;
+    }
+
+    switch(_state) {
+        case State::IDLE:
+            _instruction = data;
+            if(data == 0xC0) {
+                powerOn();
+                _readyAt = host::nanos() + _resetDelayNs;
+                _selected = true;
+                _state = State::DONE;
+            } else if(data == 0x02 || data == 0x03 || data == 0x05) {
+                _state = State::ADDRESS;
+            } else if((data & 0xF9) == 0x90) {
+                static constexpr uint8_t start[] = {0x61, 0x66, 0x71, 0x76};
+                uint8_t n = (data >> 1) & 0x03;
+                _address = start[n];
+                _clearOnDeselect = (n < 2) ? INTF_RX0IF : INTF_RX1IF;
+                _state = State::READ;
+            } else if(data >= 0x40 && data <= 0x45) {
+                static constexpr uint8_t start[] = {0x31, 0x36, 0x41, 0x46, 0x51, 0x56};
+                _address = start[data & 0x07];
+                _state = State::WRITE;
+            } else if((data & 0xF8) == 0x80) {
+                for(uint8_t n = 0; n < 3; n++) {
+                    if(data & (1 << n))
+                        bitModify(TXB_CTRL(n), TXB_TXREQ, TXB_TXREQ);
+                }
+                _state = State::DONE;
+            } else if(data == 0xA0) {
+                _state = State::STATUS;
+            } else if(data == 0xB0) {
+                _state = State::RX_STATUS;
+            } else {
+                _state = State::DONE;
+            }
+            break;
+        case State::ADDRESS:
+            _address = data & 0x7F;
+            _state = (_instruction == 0x03) ? State::READ : (_instruction == 0x02) ? State::WRITE : State::MASK;
+            break;
+        case State::READ:
+            out = readReg(_address);
+            _address = (_address + 1) & 0x7F;
+            break;
+        case State::WRITE:
+            writeReg(_address, data);
+            _address = (_address + 1) & 0x7F;
+            break;
+        case State::MASK:
+            _mask = data;
+            _state = State::MODIFY;
+            break;
+        case State::MODIFY:
+            bitModify(_address, _mask, data);
+            _state = State::DONE;
+            break;
+        case State::STATUS:
+            out = readStatus();
+            break;
+        case State::RX_STATUS:
+            out = rxStatus();
+            break;
+        case State::DONE:
+            break;
+    }
+
+    return out;
+}
+
+uint8_t MCP2515Sim::readStatus() const {
+    uint8_t intf = _regs[REG_CANINTF];
+    uint8_t st = intf & (INTF_RX0IF | INTF_RX1IF);
+    for(uint8_t n = 0; n < 3; n++) {
+        if(_regs[TXB_CTRL(n)] & TXB_TXREQ)
+            st |= 0x04 << (2 * n);
+        if(intf & (0x04 << n))
+            st |= 0x08 << (2 * n);
+    }
+    return st;
+}
+
+uint8_t MCP2515Sim::rxStatus() const {
+    uint8_t intf = _regs[REG_CANINTF];
+    bool rx0 = intf & INTF_RX0IF;
+    bool rx1 = intf & INTF_RX1IF;
+    if(!rx0 && !rx1)
+        return 0x00;
+
+    // type and filter hit refer to RXB0 if both buffers are full
+    uint8_t b = rx0 ? 0 : 1;
+    uint8_t ctrl = _regs[RXB_CTRL(b)];
+    uint8_t sidl = _regs[RXB_CTRL(b) + 2];
+
+    uint8_t st = (rx0 ? 0x40 : 0x00) | (rx1 ? 0x80 : 0x00);
+    st |= (sidl & SIDL_EXIDE) ? 0x10 : 0x00;
+    st |= (ctrl & RXB_RXRTR) ? 0x08 : 0x00;
+    if(b == 0) {
+        st |= ctrl & 0x01;
+    } else {
+        uint8_t filhit = ctrl & 0x07;
+        st |= (filhit < 2) ? (6 + filhit) : filhit;
+    }
+    return st;
+}
+
+bool MCP2515Sim::filterMatch(const Frame &frame, uint8_t filter, uint8_t mask) const {
+    uint8_t fb = (filter < 3) ? filter * 4 : 0x10 + (filter - 3) * 4;
+    uint8_t mb = REG_RXM0SIDH + mask * 4;
+
+    const uint8_t *f = &_regs[fb];
+    const uint8_t *m = &_regs[mb];
+
+    if(frame.extended != bool(f[1] & SIDL_EXIDE))
+        return false;
+
+    uint16_t fsid = (f[0] << 3) | (f[1] >> 5);
+    uint16_t msid = (m[0] << 3) | (m[1] >> 5);
+
+    if(frame.extended) {
+        uint16_t sid = frame.id >> 18;
+        uint32_t eid = frame.id & 0x3FFFF;
+        uint32_t feid = (uint32_t(f[1] & 0x03) << 16) | (f[2] << 8) | f[3];
+        uint32_t meid = (uint32_t(m[1] & 0x03) << 16) | (m[2] << 8) | m[3];
+        return !((sid ^ fsid) & msid) && !((eid ^ feid) & meid);
+    }
+
+    // standard frames: EID8/EID0 are applied to the first two data bytes
+    uint8_t d0 = (frame.dlc > 0 && !frame.rtr) ? frame.data[0] : 0;
+    uint8_t d1 = (frame.dlc > 1 && !frame.rtr) ? frame.data[1] : 0;
+    return !((frame.id ^ fsid) & msid) && !((d0 ^ f[2]) & m[2]) && !((d1 ^ f[3]) & m[3]);
+}
+
+bool MCP2515Sim::acceptsAll(uint8_t rxb) const {
+    return (_regs[RXB_CTRL(rxb)] & RXB_RXM) == RXB_RXM;
+}
+
+bool MCP2515Sim::receive(const Frame &frame) {
+    uint8_t mode = opMode();
+    if(mode != MODE_NORMAL && mode != MODE_LISTEN)
+        return false;
+    return accept(frame);
+}
+
+bool MCP2515Sim::accept(const Frame &frame) {
+    auto typeOk = [&](uint8_t rxb) {
+        uint8_t rxm = _regs[RXB_CTRL(rxb)] & RXB_RXM;
+        return !(rxm == 0x20 && frame.extended) && !(rxm == 0x40 && !frame.extended);
+    };
+
+    auto overflow = [&](uint8_t flag) {
+        _regs[REG_EFLG] |= flag;
+        _regs[REG_CANINTF] |= INTF_ERRIF;
+        _overflows++;
+        updateInt();
+        return false;
+    };
+
+    int hit = -1;
+    if(typeOk(0)) {
+        if(acceptsAll(0))
+            hit = 0;
+        else if(filterMatch(frame, 0, 0))
+            hit = 0;
+        else if(filterMatch(frame, 1, 0))
+            hit = 1;
+    }
+
+    if(hit >= 0) {
+        if(!(_regs[REG_CANINTF] & INTF_RX0IF)) {
+            store(0, frame, hit);
+            return true;
+        }
+        if(!(_regs[REG_RXB0CTRL] & RXB0_BUKT))
+            return overflow(EFLG_RX0OVR);
+        if(_regs[REG_CANINTF] & INTF_RX1IF)
+            return overflow(EFLG_RX1OVR);
+        store(1, frame, hit);
+        return true;
+    }
+
+    if(typeOk(1)) {
+        if(acceptsAll(1)) {
+            hit = 2;
+        } else {
+            for(uint8_t f = 2; f < 6 && hit < 0; f++) {
+                if(filterMatch(frame, f, 1))
+                    hit = f;
+            }
+        }
+    }
+
+    if(hit < 0)
+        return false;
+    if(_regs[REG_CANINTF] & INTF_RX1IF)
+        return overflow(EFLG_RX1OVR);
+    store(1, frame, hit);
+    return true;
+}
+
+void MCP2515Sim::store(uint8_t rxb, const Frame &frame, uint8_t filhit) {
+    uint8_t *r = &_regs[RXB_CTRL(rxb)];
+    uint8_t dlc = frame.dlc & 0x0F;
+
+    if(frame.extended) {
+        uint16_t sid = frame.id >> 18;
+        uint32_t eid = frame.id & 0x3FFFF;
+        r[1] = sid >> 3;
+        r[2] = ((sid & 0x07) << 5) | SIDL_EXIDE | ((eid >> 16) & 0x03);
+        r[3] = (eid >> 8) & 0xFF;
+        r[4] = eid & 0xFF;
+        r[5] = dlc | (frame.rtr ? DLC_RTR : 0x00);
+    } else {
+        r[1] = (frame.id >> 3) & 0xFF;
+        r[2] = ((frame.id & 0x07) << 5) | (frame.rtr ? SIDL_SRR : 0x00);
+        r[3] = 0;
+        r[4] = 0;
+        r[5] = dlc;
+    }
+
+    for(uint8_t i = 0; i < 8; i++)
+        r[6 + i] = (!frame.rtr && i < dlc) ? frame.data[i] : 0x00;
+
+    if(rxb == 0)
+        r[0] = (r[0] & (RXB_RXM | RXB0_BUKT | RXB0_BUKT1)) | (frame.rtr ? RXB_RXRTR : 0x00) | (filhit & 0x01);
+    else
+        r[0] = (r[0] & RXB_RXM) | (frame.rtr ? RXB_RXRTR : 0x00) | (filhit & 0x07);
+
+    _regs[REG_CANINTF] |= (rxb == 0) ? INTF_RX0IF : INTF_RX1IF;
+    updateInt();
+}
+
+MCP2515Sim::Frame MCP2515Sim::frameFromTx(uint8_t txb) const {
+    const uint8_t *r = &_regs[TXB_CTRL(txb)];
+    Frame frame;
+
+    uint32_t sid = (r[1] << 3) | (r[2] >> 5);
+    frame.extended = r[2] & SIDL_EXIDE;
+    if(frame.extended)
+        frame.id = (sid << 18) | (uint32_t(r[2] & 0x03) << 16) | (r[3] << 8) | r[4];
+    else
+        frame.id = sid;
+    frame.rtr = r[5] & DLC_RTR;
+    frame.dlc = r[5] & 0x0F;
+    for(uint8_t i = 0; i < 8; i++)
+        frame.data[i] = (i < frame.dlc) ? r[6 + i] : 0x00;
+    return frame;
+}
+
+bool MCP2515Sim::transmitNext() {
+    uint8_t mode = opMode();
+    if(mode != MODE_NORMAL && mode != MODE_LOOPBACK)
+        return false;
+    if(_regs[REG_CANCTRL] & CANCTRL_ABAT)
+        return false;
+
+    // highest TXP wins, on equal priority the higher buffer number is sent first
+    int best = -1;
+    for(uint8_t n = 0; n < 3; n++) {
+        uint8_t ctrl = _regs[TXB_CTRL(n)];
+        if(!(ctrl & TXB_TXREQ))
+            continue;
+        if(best < 0 || (ctrl & TXB_TXP) >= (_regs[TXB_CTRL(best)] & TXB_TXP))
+            best = n;
+    }
+    if(best < 0)
+        return false;
+
+    Frame frame = frameFromTx(best);
+    _regs[TXB_CTRL(best)] &= ~TXB_TXREQ;
+    _regs[REG_CANINTF] |= 0x04 << best;
+    updateInt();
+
+    if(mode == MODE_LOOPBACK)
+        accept(frame);
+    else
+        _txLog.push_back(frame);
+    return true;
+}
+
+void MCP2515Sim::transmitPending() {
+    if(!_txRequested)
+        return;
+    _txRequested = false;
+    while(transmitNext()) { }
+}
+
+void MCP2515Sim::setBufferFullPins(int rx0bf, int rx1bf) {
+    _rxbfPin[0] = rx0bf;
+    _rxbfPin[1] = rx1bf;
+    updateInt();
+}
+
+void MCP2515Sim::updateInt() {
+    if(_intPin >= 0) {
+        uint8_t level = (_regs[REG_CANINTE] & _regs[REG_CANINTF]) ? LOW : HIGH;
+        if(host::pinLevel(_intPin) != level)
+            host::setPinLevel(_intPin, level);
+    }
+
+    // BFPCTRL: BnBFM (bit n) selects the buffer full interrupt, BnBFE (bit n + 2) enables the pin,
+    // BnBFS (bit n + 4) is the level in digital output mode. A disabled pin is high impedance (pulled up).
+    const uint8_t bfp = _regs[REG_BFPCTRL];
+    for(uint8_t n = 0; n < 2; n++) {
+        if(_rxbfPin[n] < 0)
+            continue;
+        uint8_t level = HIGH;
+        if(bfp & (0x04 << n)) {
+            if(bfp & (0x01 << n))
+                level = (_regs[REG_CANINTF] & (INTF_RX0IF << n)) ? LOW : HIGH;
+            else
+                level = (bfp & (0x10 << n)) ? HIGH : LOW;
+        }
+        if(host::pinLevel(_rxbfPin[n]) != level)
+            host::setPinLevel(_rxbfPin[n], level);
+    }
+}
+
+void MCP2515SimTransport::select() {
+    host::spiStats().transactions++;
+    host::advance(host::costs().transactionNs);
+    if(_usingInterrupt)
+        host::maskInterrupts(true);
+    _sim.select();
+}
+
+void MCP2515SimTransport::deselect() {
+    _sim.deselect();
+    if(_usingInterrupt)
+        host::maskInterrupts(false);
+}
+
+uint8_t MCP2515SimTransport::exchange(uint8_t data) {
+    host::advance(8000000000ULL / _frequency);
+    host::spiStats().bytes++;
+    return _sim.spiTransfer(data);
+}
+
+uint8_t MCP2515SimTransport::transfer(uint8_t data) {
+    host::advance(host::costs().byteOverheadNs);
+    return exchange(data);
+}
+
+void MCP2515SimTransport::transfer(uint8_t buf[], size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        host::advance(host::costs().blockByteOverheadNs);
+        buf[i] = exchange(buf[i]);
+    }
+}
+
+void MCP2515SimTransport::write(const uint8_t buf[], size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        host::advance(host::costs().blockByteOverheadNs);
+        exchange(buf[i]);
+    }
+}
+
+void MCP2515SimTransport::transferAsync(uint8_t buf[], size_t n, Callback done, void *context) {
+    if(!_async) {
+        MCP2515Transport::transferAsync(buf, n, done, context);
+        return;
+    }
+
+    // the chip sees the bytes right away, the clock only moves on for the setup: the CPU is free
+    // until the transfer is done, the first busy() poll before that pays for the rest
+    busy();
+    _asyncTransfers++;
+    host::spiStats().transactions++;
+    host::spiStats().bytes += n;
+    host::advance(host::costs().transactionNs);
+    _sim.select();
+    for(size_t i = 0; i < n; i++)
+        buf[i] = _sim.spiTransfer(buf[i]);
+    _sim.deselect();
+
+    _doneAt = host::nanos() + n * 8000000000ULL / _frequency;
+    _done = done;
+    _context = context;
+    _running = true;
+}
+
+void MCP2515SimTransport::finish() {
+    if(!_running)
+        return;
+    if(host::nanos() < _doneAt)
+        host::advance(_doneAt - host::nanos());
+    _running = false;
+    if(_done)
+        _done(_context);
+}
+
+bool MCP2515SimTransport::busy() {
+    // polled until the transfer is done, finish() charges the wait
+    finish();
+    return false;
+}
@@ -0,0 +1,181 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <vector>
+
+#include "Transport.hpp"
+
+/// @brief Register level model of a MCP2515 connected to a simulated SPI bus
+/// The model implements the SPI instruction set, the register map (including the CANSTAT/CANCTRL mirrors),
+/// the acceptance filters, the three TX and the two RX buffers, CANINTF/EFLG and the INT pin.
+/// Frames sent by the driver are collected in a log, frames from the bus are injected with receive().
+class MCP2515Sim : public host::SpiDevice {
+    friend class MCP2515SimTransport;
+public:
+    /// @brief A frame on the simulated CAN bus
+    struct Frame {
+        uint32_t id{0};
+        bool extended{false};
+        bool rtr{false};
+        uint8_t dlc{0};
+        uint8_t data[8]{};
+
+        bool operator==(const Frame &o) const;
+    };
+
+    /// @brief Create a simulated chip
+    /// @param spi The simulated SPI bus the chip is connected to
+    /// @param csPin The chip select pin
+    /// @param intPin The INT pin driven by the chip, -1 if not connected
+    MCP2515Sim(SPIClass &spi, uint8_t csPin, int intPin = -1);
+    ~MCP2515Sim();
+
+    /// @brief Power cycle the chip, all registers get their reset values
+    void powerOn();
+
+    /// @brief Offer a frame from the bus to the chip
+    /// @return true if the frame was stored in one of the rx buffers
+    bool receive(const Frame &frame);
+
+    /// @brief Transmit pending tx buffers immediately after each SPI transaction (default: true)
+    void setAutoTransmit(bool enable) { _autoTransmit = enable; }
+
+    /// @brief Transmit the highest priority pending tx buffer
+    /// @return true if a frame was transmitted
+    bool transmitNext();
+
+    /// @brief Connect the RX0BF and RX1BF pins, -1 if not connected
+    void setBufferFullPins(int rx0bf, int rx1bf);
+
+    /// @brief Time the chip needs to reach a requested operation mode
+    void setModeSwitchDelay(uint32_t us) { _modeSwitchDelayNs = us * 1000ULL; }
+
+    /// @brief Time the chip stays in reset after a RESET instruction, SPI is ignored and MISO reads 0xFF
+    void setResetDelay(uint32_t us) { _resetDelayNs = us * 1000ULL; }
+
+    /// @brief Frames transmitted to the bus
+    std::vector<Frame> &txLog() { return _txLog; }
+
+    /// @brief Register content, without side effects
+    uint8_t reg(uint8_t address) const;
+
+    /// @brief Overwrite a register, without side effects
+    void setReg(uint8_t address, uint8_t value) { _regs[address & 0x7F] = value; }
+
+    /// @brief Current operation mode (CANSTAT.OPMOD)
+    uint8_t opMode();
+
+    /// @brief Number of writes the chip would have ignored or corrupted
+    /// (configuration registers outside config mode, tx buffers with TXREQ set, any write while in reset)
+    uint32_t violations() const { return _violations; }
+
+    /// @brief Number of frames lost because of full rx buffers
+    uint32_t overflows() const { return _overflows; }
+
+    // host::SpiDevice
+    void spiSync() override;
+    bool spiSelected() const override { return _selected; }
+    uint8_t spiTransfer(uint8_t data) override;
+
+private:
+    enum class State : uint8_t { IDLE, ADDRESS, READ, WRITE, MASK, MODIFY, STATUS, RX_STATUS, DONE };
+
+    void select();
+    void deselect();
+
+    uint8_t readReg(uint8_t address);
+    void writeReg(uint8_t address, uint8_t value);
+    void bitModify(uint8_t address, uint8_t mask, uint8_t value);
+
+    bool accept(const Frame &frame);
+    bool filterMatch(const Frame &frame, uint8_t filter, uint8_t mask) const;
+    bool acceptsAll(uint8_t rxb) const;
+    void store(uint8_t rxb, const Frame &frame, uint8_t filhit);
+    Frame frameFromTx(uint8_t txb) const;
+    void transmitPending();
+    uint8_t readStatus() const;
+    uint8_t rxStatus() const;
+    void updateInt();
+
+    SPIClass &_spi;
+    uint8_t _csPin;
+    int _intPin;
+    int _rxbfPin[2]{-1, -1};
+
+    uint8_t _regs[128]{};
+    bool _selected{false};
+    State _state{State::IDLE};
+    uint8_t _instruction{0};
+    uint8_t _address{0};
+    uint8_t _mask{0};
+    uint8_t _clearOnDeselect{0};
+    bool _txRequested{false};
+
+    uint8_t _opMode{0x80};
+    uint8_t _requestedMode{0x80};
+    uint64_t _modeChangeAt{0};
+    uint64_t _modeSwitchDelayNs{0};
+    uint64_t _readyAt{0};
+    uint64_t _resetDelayNs{0};
+
+    bool _autoTransmit{true};
+    std::vector<Frame> _txLog;
+    uint32_t _violations{0};
+    uint32_t _overflows{0};
+};
+
+/// @brief Driver transport which talks to the simulated chip directly, like a SPI peripheral with
+/// hardware chip select and DMA. Bytes are counted in host::spiStats() like on the simulated bus.
+class MCP2515SimTransport : public MCP2515Transport {
+public:
+    explicit MCP2515SimTransport(MCP2515Sim &sim) : _sim(sim) { }
+
+    /// @brief Run transferAsync() in the background: the setup costs CPU time, the bytes take their
+    /// time on the bus. A busy() poll before they are through waits for them, the callback runs
+    /// on finish() or the busy() poll which sees the transfer done (default: false)
+    void setAsync(bool enable) { _async = enable; }
+
+    /// @brief The SPI clock in Hz (default: 4MHz)
+    void setFrequency(uint32_t frequency) { _frequency = frequency; }
+
+    /// @brief Complete a running asynchronous transfer, like the DMA complete interrupt
+    /// The clock is advanced to the end of the transfer, if it is not there yet.
+    void finish();
+
+    /// @brief Number of asynchronous transfers started
+    uint32_t asyncTransfers() const { return _asyncTransfers; }
+
+    // MCP2515Transport
+    void begin() override { }
+    void select() override;
+    void deselect() override;
+    uint8_t transfer(uint8_t data) override;
+    void transfer(uint8_t buf[], size_t n) override;
+    void write(const uint8_t buf[], size_t n) override;
+    void transferAsync(uint8_t buf[], size_t n, Callback done, void *context) override;
+    bool async() const override { return _async; }
+    bool busy() override;
+    void usingInterrupt(int interruptNumber) override { (void)interruptNumber; _usingInterrupt = true; }
+    void notUsingInterrupt(int interruptNumber) override { (void)interruptNumber; _usingInterrupt = false; }
+
+private:
+    uint8_t exchange(uint8_t data);
+
+    MCP2515Sim &_sim;
+    uint32_t _frequency{4000000};
+    bool _async{false};
+    bool _usingInterrupt{false};
+    Callback _done{nullptr};
+    void *_context{nullptr};
+    bool _running{false};
+    uint64_t _doneAt{0};
+    uint32_t _asyncTransfers{0};
+};
@@ -0,0 +1,1884 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ *
+ * Runs the driver against the simulated MCP2515 and reports SPI transactions, SPI bytes
+ * and simulated time for the hot paths. Exits with a non-zero code if the driver and
+ * the simulated chip disagree.
+ */
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <chrono>
+#include <cinttypes>
+
+#include "MCP2515.h"
+#include "MCP2515T.hpp"
+#include "FrameDispatcher.hpp"
+#include "RxLatency.hpp"
+#include "MCP2515Sim.h"
+
+namespace {
+
+constexpr uint8_t CS_PIN = MCP2515_DEFAULT_CS_PIN;
+constexpr uint8_t INT_PIN = MCP2515_DEFAULT_INT_PIN;
+
+int g_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("  CHECK FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); g_failures++; } } while(0)
+
+/// @brief Measures SPI traffic and simulated time of a code block
+class Probe {
+public:
+    explicit Probe(const char *name, uint32_t iterations = 1) : _name(name), _iterations(iterations) {
+        _transactions = host::spiStats().transactions;
+        _bytes = host::spiStats().bytes;
+        _ns = host::nanos();
+    }
+
+    ~Probe() {
+        double n = _iterations;
+        printf("  %-36s %8.1f %8.1f %10.2f\n", _name,
+            (host::spiStats().transactions - _transactions) / n,
+            (host::spiStats().bytes - _bytes) / n,
+            (host::nanos() - _ns) / 1000.0 / n);
+    }
+
+private:
+    const char *_name;
+    uint32_t _iterations;
+    uint32_t _transactions;
+    uint32_t _bytes;
+    uint64_t _ns;
+};
+
+// 40 standard ids of a typical vehicle bus: a few dense blocks and some scattered ids
+constexpr uint32_t g_wantedStd[] = {
+    0x100, 0x101, 0x102, 0x103, 0x104, 0x105, 0x106, 0x107,
+    0x180, 0x181, 0x182, 0x183, 0x200, 0x201, 0x202, 0x203,
+    0x280, 0x281, 0x282, 0x283, 0x300, 0x310, 0x320, 0x330,
+    0x3E0, 0x3E1, 0x3E2, 0x3E3, 0x3E4, 0x3E5, 0x3E6, 0x3E7,
+    0x500, 0x501, 0x502, 0x503, 0x602, 0x6F1, 0x7DF, 0x7E8,
+};
+
+// planned at compile time
+constexpr FilterPlan g_planStd = planFilters(g_wantedStd, false);
+static_assert(g_planStd.accepts(0x7E8) && g_planStd.accepts(0x3E5), "planned filters must accept the wanted ids");
+static_assert(g_planStd.valid(), "planned filters must be valid");
+
+MCP2515Sim::Frame makeFrame(uint32_t id, bool extended, uint8_t dlc) {
+    MCP2515Sim::Frame f;
+    f.id = id;
+    f.extended = extended;
+    f.dlc = dlc;
+    for(uint8_t i = 0; i < dlc; i++)
+        f.data[i] = 0xA0 + i;
+    return f;
+}
+
+CANPacket makePacket(const MCP2515Sim::Frame &f) {
+    CANPacket p;
+    p.startPacket(f.id, f.extended, f.rtr);
+    p.writeData(f.data, f.dlc);
+    return p;
+}
+
+bool samePacket(const CANPacket &p, const MCP2515Sim::Frame &f) {
+    if(p.id() != f.id || p.extended() != f.extended || p.rtr() != f.rtr || p.dlc() != f.dlc)
+        return false;
+    return f.rtr || std::equal(f.data, f.data + f.dlc, p.data().begin());
+}
+
+void header(const char *title) {
+    printf("\n%s\n", title);
+    printf("  %-36s %8s %8s %10s\n", "operation", "spi-txn", "bytes", "time[us]");
+}
+
+void benchInit() {
+    header("Initialization");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    {
+        Probe p("begin(CAN_500KBPS)");
+        CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    }
+    CHECK(sim.opMode() == 0x00);
+    // 8 time quanta, sample point at 75%
+    CHECK(sim.reg(0x2A) == 0x00 && sim.reg(0x29) == 0x91 && sim.reg(0x28) == 0x01);
+    {
+        Probe p("setFilter(RXF0, std)");
+        CHECK(mcp.setFilter(MCP2515::RXF0, false, 0x123) == MCP2515Error::OK);
+    }
+    {
+        Probe p("setMask(MASK0, std)");
+        CHECK(mcp.setMask(MCP2515::MASK0, false, 0x7FF) == MCP2515Error::OK);
+    }
+    CHECK(sim.reg(0x00) == (0x123 >> 3) && sim.reg(0x01) == ((0x123 & 0x07) << 5));
+
+    // all masks and filters: one by one vs. a single configuration session
+    const MCP2515::RXF filters[] = {MCP2515::RXF0, MCP2515::RXF1, MCP2515::RXF2, MCP2515::RXF3, MCP2515::RXF4, MCP2515::RXF5};
+    {
+        Probe p("setMask x2 + setFilter x6");
+        CHECK(mcp.setMask(MCP2515::MASK0, false, 0x7F0) == MCP2515Error::OK);
+        CHECK(mcp.setMask(MCP2515::MASK1, true, 0x1FFFFF00) == MCP2515Error::OK);
+        for(uint8_t i = 0; i < 6; i++)
+            CHECK(mcp.setFilter(filters[i], i >= 2, i < 2 ? 0x100 + 0x10 * i : 0x18DA0000 + 0x100 * i) == MCP2515Error::OK);
+    }
+    uint8_t expected[0x28];
+    for(uint8_t a = 0; a < sizeof(expected); a++)
+        expected[a] = sim.reg(a);
+
+    CHECK(mcp.setLoopbackMode() == MCP2515Error::OK);
+    mcp.setFilter(MCP2515::RXF4, false, 0);
+    MCP2515::FilterConfig config;
+    config.setMask(MCP2515::MASK0, false, 0x7F0);
+    config.setMask(MCP2515::MASK1, true, 0x1FFFFF00);
+    for(uint8_t i = 0; i < 6; i++)
+        config.setFilter(filters[i], i >= 2, i < 2 ? 0x100 + 0x10 * i : 0x18DA0000 + 0x100 * i);
+    {
+        Probe p("applyFilterConfig(all)");
+        CHECK(mcp.applyFilterConfig(config) == MCP2515Error::OK);
+    }
+    bool same = true;
+    for(uint8_t a = 0; a < sizeof(expected); a++)
+        same &= ((a & 0x0F) >= 0x0C) || sim.reg(a) == expected[a];
+    CHECK(same);
+    CHECK(mcp.getMode() == MCP2515::MCP_LOOPBACK);
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+    CHECK(sim.violations() == 0);
+}
+
+void benchBoot() {
+    header("Boot (20us reset, 50us mode switch)");
+
+    MCP2515Error err;
+    uint8_t expected[0x80];
+    {
+        host::reset();
+        MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+        sim.setResetDelay(20);
+        sim.setModeSwitchDelay(50);
+        MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+        {
+            Probe p("begin(CAN_500KBPS)");
+            err = mcp.begin(MCP2515::CAN_500KBPS);
+        }
+        CHECK(err == MCP2515Error::OK);
+        CHECK(sim.opMode() == 0x00 && sim.reg(0x29) == 0x91);
+        CHECK(sim.violations() == 0);
+        for(uint8_t a = 0; a < sizeof(expected); a++)
+            expected[a] = sim.reg(a);
+    }
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    sim.setResetDelay(20);
+    sim.setModeSwitchDelay(50);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+
+    // other peripherals get 10us between the polls
+    uint32_t polls = 0;
+    uint64_t driverNs = 0;
+    uint64_t longestNs = 0;
+    uint64_t start = host::nanos();
+    {
+        Probe p("beginAsync + poll");
+        err = mcp.beginAsync(MCP2515::CAN_500KBPS);
+        driverNs = longestNs = host::nanos() - start;
+        while(err == MCP2515Error::PENDING) {
+            host::advance(10000);
+            uint64_t t = host::nanos();
+            err = mcp.poll();
+            driverNs += host::nanos() - t;
+            longestNs = std::max<uint64_t>(longestNs, host::nanos() - t);
+            polls++;
+        }
+    }
+    printf("  %u polls, %.2f us in the driver, longest call %.2f us\n", polls, driverNs / 1000.0, longestNs / 1000.0);
+    CHECK(err == MCP2515Error::OK && mcp.poll() == MCP2515Error::OK);
+    bool same = true;
+    for(uint8_t a = 0; a < sizeof(expected); a++)
+        same &= ((a & 0x0F) == 0x0E) || sim.reg(a) == expected[a];
+    CHECK(same);
+    CHECK(mcp.getMode() == MCP2515::MCP_NORMAL);
+
+    // a chip which does not come out of reset
+    sim.setResetDelay(20000);
+    {
+        Probe p("begin(no response)");
+        err = mcp.begin(MCP2515::CAN_500KBPS);
+    }
+    CHECK(err == MCP2515Error::FAILINIT && mcp.poll() == MCP2515Error::FAILINIT);
+    CHECK(sim.violations() == 0);
+}
+
+void benchModeChange() {
+    header("Mode change (1ms mode switch)");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    sim.setModeSwitchDelay(1000);
+
+    MCP2515Error err;
+    {
+        Probe p("setLoopbackMode (blocking)");
+        err = mcp.setLoopbackMode();
+    }
+    CHECK(err == MCP2515Error::OK && sim.opMode() == 0x40);
+
+    // a cooperative loop, which does 20us of other work between the checks
+    auto pollMode = [&](MCP2515::CanModes mode) {
+        uint32_t polls = 0;
+        MCP2515Error rc = mcp.requestMode(mode);
+        while(rc == MCP2515Error::PENDING) {
+            host::advance(20000);
+            rc = mcp.modeReached();
+            polls++;
+        }
+        CHECK(rc == MCP2515Error::OK && mcp.getMode() == mode);
+        return polls;
+    };
+    uint32_t polls;
+    {
+        Probe p("requestMode + modeReached");
+        polls = pollMode(MCP2515::MCP_NORMAL);
+    }
+    printf("  %u modeReached() calls\n", polls);
+
+    mcp.setModePollInterval(250);
+    {
+        Probe p("requestMode (250us poll interval)");
+        polls = pollMode(MCP2515::MCP_LOOPBACK);
+    }
+    printf("  %u modeReached() calls\n", polls);
+    {
+        Probe p("setNormalMode (250us poll interval)");
+        err = mcp.setNormalMode();
+    }
+    CHECK(err == MCP2515Error::OK && sim.opMode() == 0x00);
+    mcp.setModePollInterval(0);
+    // with the register shadow, the current mode is known and there is nothing to wait for
+    err = mcp.requestMode(MCP2515::MCP_NORMAL);
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    CHECK(err == MCP2515Error::OK);
+#endif
+    CHECK(mcp.modeReached() == MCP2515Error::OK);
+
+    // the 10ms deadline across the millis() wraparound
+    constexpr uint64_t beforeWrap = (0x100000000ULL - 5) * 1000000ULL;
+    host::setNanos(beforeWrap);
+    CHECK(mcp.setLoopbackMode() == MCP2515Error::OK && mcp.getMode() == MCP2515::MCP_LOOPBACK);
+
+    // a mode which is not reached in time
+    sim.setModeSwitchDelay(20000);
+    host::setNanos(beforeWrap);
+    CHECK(mcp.setNormalMode() == MCP2515Error::FAIL);
+    uint64_t elapsed = host::nanos() - beforeWrap;
+    CHECK(elapsed >= 10000000ULL && elapsed < 10100000ULL);
+    CHECK(mcp.modeReached() == MCP2515Error::FAIL);
+    CHECK(sim.violations() == 0);
+}
+
+// computed at compile time, 83.3k is not in the CanSpeed tables of most drivers for 8MHz
+constexpr BitTiming g_timing83k = bitTiming<8000000, 83333>();
+static_assert(g_timing83k.bitrate == 83333 && g_timing83k.samplePoint == 875, "exact 83.3k with 24 time quanta");
+
+void benchBitTiming() {
+    header("Bit timing");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    {
+        Probe p("begin(BitTiming)");
+        CHECK(mcp.begin(g_timing83k) == MCP2515Error::OK);
+    }
+    CHECK(sim.reg(0x2A) == g_timing83k.cnf1 && sim.reg(0x29) == g_timing83k.cnf2 && sim.reg(0x28) == g_timing83k.cnf3);
+    {
+        Probe p("setBitrate(CAN_125KBPS)");
+        CHECK(mcp.setBitrate(MCP2515::CAN_125KBPS) == MCP2515Error::OK);
+    }
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+
+    // below 2.5k (8MHz) resp. 6.25k (20MHz) the prescaler runs out, 1M needs 4 time quanta at 8MHz
+    CHECK(mcp.setBitrate(MCP2515::CAN_1KBPS) == MCP2515Error::FAIL);
+    CHECK(mcp.setBitrate(MCP2515::CAN_1000KBPS) == MCP2515Error::FAIL);
+    CHECK(!calcBitTiming(20000000, 5000) && !calcBitTiming(12000000, 800000));
+
+    // every timing the solver returns must keep the datasheet limits and hit the bitrate
+    const uint32_t oscillators[] = {8000000, 12000000, 16000000, 20000000};
+    uint32_t solved = 0;
+    bool legal = true;
+    for(uint32_t osc : oscillators) {
+        for(uint32_t rate = 2500; rate <= 1000000; rate += 2500) {
+            for(uint8_t sjw = 1; sjw <= 4; sjw++) {
+                BitTiming t = calcBitTiming(osc, rate, 800, sjw);
+                if(!t)
+                    continue;
+                solved++;
+                uint8_t brp = (t.cnf1 & 0x3F) + 1;
+                uint8_t prop = (t.cnf2 & 0x07) + 1;
+                uint8_t ps1 = ((t.cnf2 >> 3) & 0x07) + 1;
+                uint8_t ps2 = (t.cnf3 & 0x07) + 1;
+                uint8_t n = 1 + prop + ps1 + ps2;
+                legal &= (t.cnf1 >> 6) + 1 == sjw && (t.cnf2 & 0x80);
+                legal &= n >= 5 && n <= 25 && ps2 >= 2 && prop + ps1 >= ps2 && sjw <= ps1 && sjw < ps2;
+                legal &= 400ULL * brp * n * rate >= 199ULL * osc && 400ULL * brp * n * rate <= 201ULL * osc;
+            }
+        }
+    }
+    CHECK(legal);
+    printf("  %u of %u oscillator/bitrate/sjw combinations (2.5k steps) solved\n", solved, 4 * 400 * 4);
+
+    // PS2 has to be longer than SJW, 87.5% alone would leave PS2 = 2 time quanta
+    bool longerPs2 = true;
+    for(uint8_t sjw = 2; sjw <= 4; sjw++) {
+        BitTiming t = calcBitTiming(16000000, 500000, 875, sjw);
+        longerPs2 &= t && (t.cnf3 & 0x07) + 1 > sjw && (t.cnf1 >> 6) + 1 == sjw;
+    }
+    CHECK(longerPs2);
+
+    // the CanSpeed values resolve to the timings of the solver
+    const uint32_t speedRates[] = {1000, 5000, 10000, 12500, 16000, 20000, 25000, 31250, 33333, 40000, 50000,
+        80000, 83333, 95000, 100000, 125000, 200000, 250000, 500000, 800000, 1000000};
+    const MCP2515::CanClock clocks[] = {MCP2515::MCP_8MHZ, MCP2515::MCP_12MHZ, MCP2515::MCP_16MHZ, MCP2515::MCP_20MHZ};
+    bool resolved = true;
+    for(uint8_t c = 0; c < 4; c++) {
+        MCP2515 clocked(CS_PIN, clocks[c]);
+        CHECK(clocked.begin(MCP2515::CAN_250KBPS) == MCP2515Error::OK);
+        for(uint8_t speed = 0; speed < 21; speed++) {
+            BitTiming t = calcBitTiming(oscillators[c], speedRates[speed]);
+            MCP2515Error rc = clocked.setBitrate(static_cast<MCP2515::CanSpeed>(speed));
+            resolved &= t ? (rc == MCP2515Error::OK && sim.reg(0x2A) == t.cnf1 && sim.reg(0x29) == t.cnf2 &&
+                sim.reg(0x28) == t.cnf3) : rc == MCP2515Error::FAIL;
+        }
+    }
+    CHECK(resolved);
+    CHECK(sim.violations() == 0);
+}
+
+void benchFilterPlanner() {
+    header("Filter planner");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    {
+        Probe p("applyFilterPlan");
+        CHECK(mcp.applyFilterPlan(g_planStd) == MCP2515Error::OK);
+    }
+
+    // offer every standard id to the simulated chip
+    uint32_t accepted = 0;
+    bool consistent = true;
+    MCP2515CanPaket packet;
+    for(uint32_t id = 0; id <= 0x7FF; id++) {
+        bool rx = sim.receive(makeFrame(id, false, 0));
+        if(rx)
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.id() == id);
+        consistent &= (rx == g_planStd.accepts(id));
+        accepted += rx;
+    }
+    for(uint32_t id : g_wantedStd)
+        CHECK(g_planStd.accepts(id));
+    CHECK(consistent);
+    CHECK(accepted == g_planStd.acceptedWeight);
+    printf("  40 wanted std ids: %u of 2048 ids accepted, false accept ratio %.3f\n",
+        accepted, g_planStd.falseAcceptRatio());
+
+    // extended ids, weighted by the bus load: the chatty neighbour of a wanted id must stay out
+    static constexpr uint32_t wantedExt[] = {0x18FEF100, 0x18FEF200, 0x18FEE000, 0x0CF00400, 0x0CF00300, 0x18FEEE00, 0x18FEF500};
+    static constexpr CanTraffic traffic[] = {
+        {0x18FEF100, 10}, {0x18FEF200, 10}, {0x18FEE000, 1}, {0x0CF00400, 100}, {0x0CF00300, 20},
+        {0x18FEEE00, 1}, {0x18FEF500, 1}, {0x0CF00401, 500}, {0x18FEF300, 50}, {0x18FEE100, 5},
+        {0x0C000000, 200}, {0x18FF0000, 30},
+    };
+    constexpr FilterPlan planExt = planFilters(wantedExt, true, traffic);
+    CHECK(!planExt.accepts(0x0CF00401));
+    bool all = true;
+    for(uint32_t id : wantedExt)
+        all &= planExt.accepts(id);
+    CHECK(all);
+    printf("  7 wanted ext ids (weighted): %llu of %llu frames/s falsely accepted, ratio %.3f\n",
+        (unsigned long long)planExt.falseWeight, (unsigned long long)planExt.acceptedWeight, planExt.falseAcceptRatio());
+
+    CHECK(mcp.applyFilterPlan(planExt) == MCP2515Error::OK);
+    CHECK(sim.receive(makeFrame(0x0CF00400, true, 8)) && !sim.receive(makeFrame(0x0CF00401, true, 8)));
+
+    // an extended id can't be planned together with standard ids
+    static constexpr uint32_t mixed[] = {0x100, 0x18FEF100};
+    constexpr FilterPlan planMixed = planFilters(mixed, false);
+    static_assert(!planMixed.valid(), "mixed id sets must be rejected");
+    CHECK(mcp.applyFilterPlan(planMixed) == MCP2515Error::FAIL);
+    CHECK(sim.violations() == 0);
+}
+
+void benchTx() {
+    header("Transmit");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+
+    constexpr uint32_t N = 100;
+    auto std8 = makeFrame(0x123, false, 8);
+    auto ext8 = makeFrame(0x1ABCDEF, true, 8);
+    {
+        Probe p("sendMessage(std, 8 bytes)", N);
+        for(uint32_t i = 0; i < N; i++)
+            CHECK(mcp.sendMessage(makePacket(std8)) == MCP2515Error::OK);
+    }
+    {
+        Probe p("sendMessage(ext, 8 bytes)", N);
+        for(uint32_t i = 0; i < N; i++)
+            CHECK(mcp.sendMessage(makePacket(ext8)) == MCP2515Error::OK);
+    }
+    CHECK(sim.txLog().size() == 2 * N);
+    CHECK(sim.txLog().front() == std8);
+    CHECK(sim.txLog().back() == ext8);
+
+    CANPacket batch[5];
+    for(uint8_t i = 0; i < 5; i++)
+        batch[i] = makePacket(makeFrame(0x700 + i, false, 8));
+    sim.txLog().clear();
+    {
+        Probe p("sendMessage x3", N);
+        for(uint32_t i = 0; i < N; i++) {
+            for(uint8_t j = 0; j < 3; j++)
+                CHECK(mcp.sendMessage(batch[j]) == MCP2515Error::OK);
+        }
+    }
+    {
+        Probe p("sendMessages(3)", N);
+        for(uint32_t i = 0; i < N; i++)
+            CHECK(mcp.sendMessages(batch, 3) == 3);
+    }
+    bool ordered = true;
+    for(uint32_t i = 0; i < sim.txLog().size(); i++)
+        ordered &= (sim.txLog()[i].id == 0x700 + i % 3);
+    CHECK(sim.txLog().size() == 2 * 3 * N && ordered);
+
+    // more messages than tx buffers, the rest goes into the queue
+    sim.setAutoTransmit(false);
+    sim.txLog().clear();
+    CHECK(mcp.sendMessages(batch, 5) == 5);
+    CHECK(mcp.getTxQueueLength() == 2);
+    while(sim.transmitNext())
+        mcp.processTxQueue();
+    ordered = sim.txLog().size() == 5;
+    for(uint32_t i = 0; i < sim.txLog().size(); i++)
+        ordered &= (sim.txLog()[i].id == 0x700 + i);
+    CHECK(ordered);
+    mcp.processTxQueue();
+
+    for(int i = 0; i < 3; i++)
+        CHECK(mcp.sendMessage(makePacket(std8)) == MCP2515Error::OK);
+    {
+        Probe p("sendMessage(all tx buffers busy)");
+        CHECK(mcp.sendMessage(makePacket(std8)) == MCP2515Error::OK);
+    }
+    CHECK(mcp.getTxQueueLength() == 1);
+    CHECK(sim.violations() == 0);
+}
+
+MCP2515 *g_isrDriver = nullptr;
+
+void benchTxQueue() {
+    header("Transmit queue (INT driven)");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+
+    g_isrDriver = &mcp;
+    SPI.usingInterrupt(digitalPinToInterrupt(INT_PIN));
+    attachInterrupt(digitalPinToInterrupt(INT_PIN), [] { g_isrDriver->handleInterrupt(); }, FALLING);
+
+    // the bus is slower than the driver, every frame the application can't place is retried after the next transmission
+    sim.setAutoTransmit(false);
+    constexpr uint32_t N = 200;
+    uint32_t rejected = 0;
+    {
+        Probe p("burst of 200 frames", N);
+        for(uint32_t i = 0; i < N; i++) {
+            auto f = makeFrame(i & 0x7FF, false, 8);
+            while(mcp.sendMessage(makePacket(f)) != MCP2515Error::OK) {
+                rejected++;
+                sim.transmitNext();
+            }
+        }
+        while(sim.transmitNext()) { }
+    }
+    printf("  %u of %u frames rejected with ALLTXBUSY (queue size %u)\n", rejected, N, MCP2515_CANPACKET_TX_QUEUE_SIZE);
+
+    CHECK(sim.txLog().size() == N);
+    bool ordered = true;
+    for(uint32_t i = 0; i < sim.txLog().size(); i++)
+        ordered &= (sim.txLog()[i].id == (i & 0x7FF));
+    CHECK(ordered);
+    CHECK(mcp.getTxQueueLength() == 0);
+    CHECK(host::pinLevel(INT_PIN) == HIGH);
+
+    // received messages are polled, so one left in an rx buffer holds INT low and the completed
+    // transmissions cause no edge. The polling calls keep the queue moving until it is read.
+    sim.txLog().clear();
+    sim.receive(makeFrame(0x123, false, 8));
+    CHECK(host::pinLevel(INT_PIN) == LOW);
+    for(uint32_t i = 0; i < 6; i++)
+        CHECK(mcp.sendMessage(makePacket(makeFrame(0x600 + i, false, 8))) == MCP2515Error::OK);
+    CHECK(mcp.getTxQueueLength() == 3);
+    while(sim.transmitNext())
+        CHECK(mcp.checkMessage());
+    CHECK(sim.txLog().size() == 6);
+    MCP2515CanPaket packet;
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    CHECK(mcp.getTxQueueLength() == 0);
+    CHECK(host::pinLevel(INT_PIN) == HIGH);
+    CHECK(sim.violations() == 0);
+
+    detachInterrupt(digitalPinToInterrupt(INT_PIN));
+}
+
+void benchRx() {
+    header("Receive");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+
+    constexpr uint32_t N = 100;
+    auto std8 = makeFrame(0x321, false, 8);
+    auto ext8 = makeFrame(0x12345678 & 0x1FFFFFFF, true, 8);
+    MCP2515CanPaket packet;
+    {
+        Probe p("readMessage(no message)", N);
+        for(uint32_t i = 0; i < N; i++)
+            CHECK(mcp.readMessage(packet) == MCP2515Error::NOMSG);
+    }
+    {
+        Probe p("readMessage(std, 8 bytes)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            sim.receive(std8);
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+        }
+    }
+    CHECK(samePacket(packet, std8));
+    {
+        Probe p("readMessage(ext, 8 bytes)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            sim.receive(ext8);
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+        }
+    }
+    CHECK(samePacket(packet, ext8));
+
+    // a reused packet must not keep flags of the previous frame
+    sim.receive(std8);
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    CHECK(samePacket(packet, std8));
+
+    // both rx buffers full, one frame each
+    mcp.setRxBufferRollover(true);
+    {
+        Probe p("readMessage x2 (both buffers full)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            sim.receive(std8);
+            sim.receive(ext8);
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+        }
+    }
+    MCP2515CanPaket batch[4];
+    {
+        Probe p("readMessages (both buffers full)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            sim.receive(std8);
+            sim.receive(ext8);
+            CHECK(mcp.readMessages(batch, 4) == 2);
+        }
+    }
+    CHECK(samePacket(batch[0], std8) && samePacket(batch[1], ext8));
+    CHECK(batch[0].getRxBuffer() == 0 && batch[1].getRxBuffer() == 1);
+    CHECK(mcp.readMessages(batch, 4) == 0);
+    sim.receive(std8);
+    sim.receive(ext8);
+    CHECK(mcp.readMessages(batch, 1) == 1 && samePacket(batch[0], std8));
+    CHECK(mcp.readMessages(batch, 1) == 1 && samePacket(batch[0], ext8));
+
+    // buffer, filter hit and remote flag come from RX STATUS, RXB1CTRL is read if both buffers are full
+    CHECK(mcp.setMask(MCP2515::MASK0, false, 0x7FF) == MCP2515Error::OK);
+    CHECK(mcp.setMask(MCP2515::MASK1, false, 0x7FF) == MCP2515Error::OK);
+    const MCP2515::RXF filters[] = {MCP2515::RXF0, MCP2515::RXF1, MCP2515::RXF2, MCP2515::RXF3, MCP2515::RXF4, MCP2515::RXF5};
+    for(uint8_t i = 0; i < 6; i++)
+        CHECK(mcp.setFilter(filters[i], false, 0x100 + i) == MCP2515Error::OK);
+    auto remote = makeFrame(0x104, false, 4);
+    remote.rtr = true;
+    struct { uint32_t first, second; uint8_t hits[2], buffers[2]; } hits[] = {
+        {0x101, 0,     {1, 0}, {0, 0}},
+        {0x104, 0,     {4, 0}, {1, 0}},
+        {0x101, 0x100, {1, 0}, {0, 1}},  // RXF0 rolled over into RXB1
+        {0x100, 0x103, {0, 3}, {0, 1}},
+    };
+    for(const auto &h : hits) {
+        sim.receive(makeFrame(h.first, false, 8));
+        if(h.second)
+            sim.receive(makeFrame(h.second, false, 8));
+        size_t n = h.second ? 2 : 1;
+        CHECK(mcp.readMessages(batch, 4) == n);
+        for(size_t i = 0; i < n; i++)
+            CHECK(batch[i].getFilterHif() == h.hits[i] && batch[i].getRxBuffer() == h.buffers[i] && !batch[i].rtr());
+    }
+    sim.receive(makeFrame(0x100, false, 8));
+    sim.receive(remote);
+    CHECK(mcp.readMessages(batch, 4) == 2 && !batch[0].rtr() && samePacket(batch[1], remote) && batch[1].getFilterHif() == 4);
+    sim.receive(remote);
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && samePacket(packet, remote) && packet.getFilterHif() == 4);
+
+    CHECK(sim.overflows() == 0);
+    CHECK(sim.violations() == 0);
+}
+
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+/// @brief Gives the bench access to the register shadow
+class ShadowedMCP2515 : public MCP2515 {
+public:
+    using MCP2515::MCP2515;
+    using MCP2515::modifyRegister;
+    using MCP2515::writeBatch;
+
+    /// @brief Compare every known register with the simulated chip
+    /// @return The number of known registers, -1 on a mismatch
+    int compareShadow(const MCP2515Sim &sim) const {
+        int known = 0;
+        for(uint16_t address = 0; address < 0x80; address++) {
+            // CANCTRL is mapped into every block
+            if(!_shadow.known(address) || ((address & 0x0F) == 0x0F && address != 0x0F))
+                continue;
+            // only the bits written by the driver, RXRTR, FILHIT and REQOP are changed by the chip
+            uint8_t writable = 0xFF;
+            if(address == 0x60)
+                writable = 0x64;
+            else if(address == 0x70)
+                writable = 0x60;
+            else if((address & 0x0F) == 0x0F)
+                writable = 0x1F;
+            if(_shadow.changes(address, writable, sim.reg(address)))
+                return -1;
+            known++;
+        }
+        return known;
+    }
+};
+
+void benchRegisterShadow() {
+    header("Register shadow");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    ShadowedMCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    CHECK(mcp.compareShadow(sim) > 0);
+
+    mcp.setOneShotMode(true);
+    {
+        Probe p("setOneShotMode(unchanged)");
+        mcp.setOneShotMode(true);
+    }
+    mcp.setRxBufferRollover(true);
+    {
+        Probe p("setRxBufferRollover(unchanged)");
+        mcp.setRxBufferRollover(true);
+    }
+    mcp.setWakeupFilter(true);
+    {
+        Probe p("setWakeupFilter(unchanged)");
+        mcp.setWakeupFilter(true);
+    }
+    {
+        Probe p("getMode");
+        CHECK(mcp.getMode() == MCP2515::MCP_NORMAL);
+    }
+    {
+        Probe p("setNormalMode(already normal)");
+        CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+    }
+    CHECK(mcp.applyFilterPlan(g_planStd) == MCP2515Error::OK);
+    {
+        Probe p("applyFilterPlan(unchanged)");
+        CHECK(mcp.applyFilterPlan(g_planStd) == MCP2515Error::OK);
+    }
+    CHECK(mcp.getMode() == MCP2515::MCP_NORMAL && sim.opMode() == 0x00);
+    // all filters, both masks, CNF1..3, CANINTE, RXBnCTRL and CANCTRL
+    CHECK(mcp.compareShadow(sim) == 39);
+
+    mcp.setClockOut(MCP2515::CLKOUT_DIV2);
+    CHECK(mcp.setBitrate(MCP2515::CAN_250KBPS) == MCP2515Error::OK);
+    mcp.setOneShotMode(false);
+    mcp.setRxBufferRollover(false);
+    CHECK(mcp.setLoopbackMode() == MCP2515Error::OK);
+    CHECK(mcp.compareShadow(sim) == 39);
+    CHECK(mcp.getMode() == MCP2515::MCP_LOOPBACK && sim.opMode() == 0x40);
+
+    // a received message changes FILHIT, the shadow still skips the unchanged BUKT bit
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+    CHECK(sim.receive(makeFrame(0x7E8, false, 8)));
+    MCP2515CanPaket packet;
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.id() == 0x7E8);
+    CHECK(mcp.compareShadow(sim) == 39);
+
+    // the mode is not cached, the chip may wake up on its own
+    CHECK(mcp.setSleepMode() == MCP2515Error::OK);
+    {
+        Probe p("getMode(sleep)");
+        CHECK(mcp.getMode() == MCP2515::MCP_SLEEP);
+    }
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+
+    // neither is any other mode, a brown-out puts the chip back into configuration mode
+    sim.powerOn();
+    CHECK(mcp.getMode() == MCP2515::MCP_CONFIG);
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK && sim.opMode() == 0x00);
+    CHECK(sim.violations() == 0);
+}
+
+void benchRegisterBatch() {
+    header("Register batch");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    ShadowedMCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    {
+        Probe p("setClockOut(CLKOUT_DIV2)");
+        mcp.setClockOut(MCP2515::CLKOUT_DIV2);
+    }
+    CHECK((sim.reg(0x0F) & 0x07) == 0x05 && !(sim.reg(0x28) & 0x80));
+    mcp.setClockOut(MCP2515::CLKOUT_DISABLE);
+    CHECK(!(sim.reg(0x0F) & 0x04));
+
+    // bit modifies of CANINTE and CNF1..3, one by one and as a batch
+    CHECK(mcp.setConfigMode() == MCP2515Error::OK);
+    {
+        Probe p("modifyRegister x4");
+        mcp.modifyRegister(0x2B, 0x03, 0x00);
+        mcp.modifyRegister(0x28, 0x40, 0x40);
+        mcp.modifyRegister(0x29, 0x40, 0x40);
+        mcp.modifyRegister(0x2A, 0xC0, 0x40);
+    }
+    const uint8_t expected[] = {sim.reg(0x28), sim.reg(0x29), sim.reg(0x2A), sim.reg(0x2B)};
+    CHECK(mcp.setBitrate(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    mcp.modifyRegister(0x2B, 0x03, 0x03);
+    internal::RegisterBatch batch;
+    batch.modify(0x2B, 0x03, 0x00);
+    batch.modify(0x28, 0x40, 0x40);
+    batch.modify(0x29, 0x40, 0x40);
+    batch.modify(0x2A, 0x80, 0x00);
+    batch.modify(0x2A, 0x40, 0x40);
+    CHECK(batch.size() == 4);
+    {
+        Probe p("writeBatch (4 registers)");
+        mcp.writeBatch(batch);
+    }
+    CHECK(sim.reg(0x28) == expected[0] && sim.reg(0x29) == expected[1]);
+    CHECK(sim.reg(0x2A) == expected[2] && sim.reg(0x2B) == expected[3]);
+    {
+        Probe p("writeBatch (unchanged)");
+        mcp.writeBatch(batch);
+    }
+    CHECK(mcp.compareShadow(sim) == 39);
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+    CHECK(sim.violations() == 0);
+}
+#endif
+
+/// @brief Host time per call of a lookup, in ns
+template<typename F>
+double hostNsPerLookup(F lookup, uint32_t iterations) {
+    volatile uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < iterations; i++)
+        sink = sink + lookup(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+bool linearScan(const uint32_t ids[], size_t n, uint32_t id) {
+    for(size_t i = 0; i < n; i++) {
+        if(ids[i] == id)
+            return true;
+    }
+    return false;
+}
+
+void benchSoftwareFilter() {
+    header("Software filter");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+
+    // the hardware filters let some unwanted ids pass, the software filter removes them
+    CHECK(mcp.applyFilterPlan(g_planStd) == MCP2515Error::OK);
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+    SoftwareFilter filter;
+    for(uint32_t id : g_wantedStd)
+        filter.allow(id, false);
+    mcp.setSoftwareFilter(&filter);
+
+    uint32_t unwanted = 0;
+    while(linearScan(g_wantedStd, 40, unwanted) || !g_planStd.accepts(unwanted))
+        unwanted++;
+
+    constexpr uint32_t N = 100;
+    auto wanted8 = makeFrame(0x3E5, false, 8);
+    auto unwanted8 = makeFrame(unwanted, false, 8);
+    MCP2515CanPaket packet;
+    {
+        Probe p("readMessage(accepted, 8 bytes)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            CHECK(sim.receive(wanted8));
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+        }
+    }
+    CHECK(samePacket(packet, wanted8));
+    {
+        Probe p("readMessage(rejected, 8 bytes)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            CHECK(sim.receive(unwanted8));
+            CHECK(mcp.readMessage(packet) == MCP2515Error::NOMSG);
+        }
+    }
+    // the rejected frame released the buffer and did not touch the packet
+    CHECK(samePacket(packet, wanted8));
+    CHECK(mcp.readMessage(packet) == MCP2515Error::NOMSG);
+
+    // a rejected frame in RXB0 must not hide an accepted one in RXB1,
+    // both buffers accept everything so that the second frame rolls over
+    MCP2515::FilterConfig open;
+    open.setMask(MCP2515::MASK0, false, 0);
+    open.setMask(MCP2515::MASK1, false, 0);
+    CHECK(mcp.applyFilterConfig(open) == MCP2515Error::OK);
+    mcp.setRxBufferRollover(true);
+    CHECK(sim.receive(unwanted8) && sim.receive(wanted8));
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && samePacket(packet, wanted8));
+    MCP2515CanPaket batch[2];
+    CHECK(sim.receive(unwanted8) && sim.receive(wanted8));
+    CHECK(mcp.readMessages(batch, 2) == 1 && samePacket(batch[0], wanted8));
+    CHECK(sim.overflows() == 0);
+
+    mcp.enableInterrupts();
+    // the INT handler drops rejected frames instead of queueing them
+    for(uint32_t i = 0; i < 4; i++)
+        CHECK(sim.receive(i & 1 ? wanted8 : unwanted8));
+    CHECK(mcp.readMessages(batch, 2) == 2);
+    CHECK(mcp.readMessage(packet) == MCP2515Error::NOMSG);
+    mcp.disableInterrupts();
+    mcp.setSoftwareFilter(nullptr);
+
+    // lookup cost on the host, the bitmap against a scan of the id list
+    bool consistent = true;
+    for(uint32_t id = 0; id <= 0x7FF; id++)
+        consistent &= (filter.accepts(id, false) == linearScan(g_wantedStd, 40, id));
+    CHECK(consistent);
+
+    constexpr uint32_t LOOKUPS = 1000000;
+    // mostly rejected ids, the worst case of the scan
+    double nsBitmap = hostNsPerLookup([&](uint32_t i) { return filter.accepts((i * 7) & 0x7FF, false); }, LOOKUPS);
+    double nsScan = hostNsPerLookup([&](uint32_t i) { return linearScan(g_wantedStd, 40, (i * 7) & 0x7FF); }, LOOKUPS);
+    printf("  40 std ids, host ns per lookup: bitmap %.2f, linear scan %.2f\n", nsBitmap, nsScan);
+
+    uint32_t extIds[64];
+    uint32_t extTable[64];
+    SoftwareFilter extFilter(extTable, 64);
+    for(uint32_t i = 0; i < 64; i++)
+        extIds[i] = 0x18FE0000 + i * 0x1234;
+    // inserted in reverse order, the table keeps itself sorted
+    for(uint32_t i = 0; i < 64; i++)
+        CHECK(extFilter.allow(extIds[63 - i], true));
+    CHECK(!extFilter.allow(0x1FFFFFFF, true));
+    consistent = true;
+    for(uint32_t i = 0; i < 0x80000; i += 0x11)
+        consistent &= (extFilter.accepts(0x18FE0000 + i, true) == linearScan(extIds, 64, 0x18FE0000 + i));
+    CHECK(consistent);
+    extFilter.block(extIds[10], true);
+    CHECK(!extFilter.accepts(extIds[10], true) && extFilter.accepts(extIds[11], true));
+    CHECK(extFilter.allow(extIds[10], true));
+
+    nsBitmap = hostNsPerLookup([&](uint32_t i) { return extFilter.accepts(0x18FE0000 + (i & 0x7FFFF), true); }, LOOKUPS);
+    nsScan = hostNsPerLookup([&](uint32_t i) { return linearScan(extIds, 64, 0x18FE0000 + (i & 0x7FFFF)); }, LOOKUPS);
+    printf("  64 ext ids, host ns per lookup: binary search %.2f, linear scan %.2f\n", nsBitmap, nsScan);
+    CHECK(sim.violations() == 0);
+}
+
+uint32_t g_idCalls = 0;
+uint32_t g_filterCalls = 0;
+uint32_t g_defaultCalls = 0;
+
+void onIdFrame(const MCP2515CanPaket &) { g_idCalls++; }
+void onFilterFrame(const MCP2515CanPaket &) { g_filterCalls++; }
+void onSlowFrame(const MCP2515CanPaket &) { delayMicroseconds(20); }
+void onDefaultFrame(const MCP2515CanPaket &) { g_defaultCalls++; }
+
+/// @brief Route an id the way applications do without a dispatcher
+int idChain(const uint32_t ids[], size_t n, uint32_t id) {
+    for(size_t i = 0; i < n; i++) {
+        if(ids[i] == id)
+            return i;
+    }
+    return -1;
+}
+
+void benchDispatcher() {
+    header("Frame dispatcher");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+
+    // RXF0 and RXF1 accept 16 ids each, RXF2..RXF5 blocks of 16 ids for the other buffer
+    MCP2515::FilterConfig config;
+    config.setMask(MCP2515::MASK0, false, 0x7F0);
+    config.setMask(MCP2515::MASK1, false, 0x7F0);
+    const MCP2515::RXF filters[] = {MCP2515::RXF0, MCP2515::RXF1, MCP2515::RXF2, MCP2515::RXF3, MCP2515::RXF4, MCP2515::RXF5};
+    for(uint8_t i = 0; i < 6; i++)
+        config.setFilter(filters[i], false, 0x100 + 0x10 * i);
+    CHECK(mcp.applyFilterConfig(config) == MCP2515Error::OK);
+    CHECK(mcp.setNormalMode() == MCP2515Error::OK);
+
+    // 32 message types in id tables, RXF2 by filter, the rest to the default handler
+    FrameDispatcher dispatcher;
+    FrameDispatcher::Route table0[16];
+    FrameDispatcher::Route table1[16];
+    for(uint8_t i = 0; i < 16; i++) {
+        table0[i].handler = onIdFrame;
+        table1[i].handler = onIdFrame;
+    }
+    table1[15].handler = onSlowFrame;
+    dispatcher.setIdTable(0, 0x100, table0, 16);
+    dispatcher.setIdTable(1, 0x110, table1, 16);
+    dispatcher.onFilter(2, onFilterFrame);
+    dispatcher.onDefault(onDefaultFrame);
+    mcp.setDispatcher(&dispatcher);
+    mcp.enableInterrupts();
+
+    uint32_t ids[32];
+    for(uint32_t i = 0; i < 32; i++)
+        ids[i] = 0x100 + i;
+
+    constexpr uint32_t N = 64;
+    {
+        Probe p("processRxQueue (id table)", N);
+        for(uint32_t i = 0; i < N; i++) {
+            CHECK(sim.receive(makeFrame(ids[i % 31], false, 8)));
+            mcp.processRxQueue();
+        }
+    }
+    CHECK(g_idCalls == N);
+    CHECK(table0[1].stats.calls == 3 && table0[3].stats.calls == 2 && table1[0].stats.calls == 2 && table1[14].stats.calls == 2);
+
+    CHECK(sim.receive(makeFrame(0x11F, false, 8)));
+    CHECK(sim.receive(makeFrame(0x125, false, 8)));
+    CHECK(sim.receive(makeFrame(0x13A, false, 8)));
+    CHECK(sim.receive(makeFrame(0x151, false, 8)));
+    mcp.processRxQueue();
+    CHECK(table1[15].stats.calls == 1);
+#ifdef MCP2515_ENABLE_DISPATCH_TIMING
+    CHECK(table1[15].stats.maxMicros >= 20 && table1[15].stats.totalMicros >= 20);
+#endif
+    CHECK(dispatcher.filterStats(2).calls == 1 && g_filterCalls == 1);
+    CHECK(dispatcher.defaultStats().calls == 2 && g_defaultCalls == 2);
+
+    // polled reads only return the messages no handler took, a dropped one counts as unhandled
+    dispatcher.onDefault(nullptr);
+    mcp.disableInterrupts();
+    MCP2515CanPaket packet;
+    CHECK(sim.receive(makeFrame(0x101, false, 8)));
+    CHECK(sim.receive(makeFrame(0x151, false, 8)));
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.id() == 0x151);
+    CHECK(mcp.readMessage(packet) == MCP2515Error::NOMSG);
+    CHECK(sim.receive(makeFrame(0x152, false, 8)));
+    CHECK(sim.receive(makeFrame(0x102, false, 8)));
+    MCP2515CanPaket polled[2];
+    CHECK(mcp.readMessages(polled, 2) == 1 && polled[0].id() == 0x152);
+    CHECK(table0[1].stats.calls == 4 && table0[2].stats.calls == 3 && dispatcher.unhandled() == 0);
+    CHECK(sim.receive(makeFrame(0x153, false, 8)));
+    mcp.processRxQueue();
+    CHECK(dispatcher.unhandled() == 1);
+
+    // without a default handler the message goes to the callback, which takes it
+    static uint32_t callbackCalls = 0;
+    mcp.onReceivePacket([](const MCP2515CanPaket &) { callbackCalls++; });
+    CHECK(sim.receive(makeFrame(0x151, false, 8)));
+    mcp.processRxQueue();
+    CHECK(callbackCalls == 1 && dispatcher.unhandled() == 1);
+    mcp.onReceivePacket(nullptr);
+
+    // interrupt mode, the same from the rx queue
+    CHECK(sim.receive(makeFrame(0x101, false, 8)));
+    CHECK(sim.receive(makeFrame(0x154, false, 8)));
+    CHECK(sim.receive(makeFrame(0x103, false, 8)));
+    MCP2515CanPaket queued[2];
+    CHECK(mcp.readMessages(queued, 2) == 1 && queued[0].id() == 0x154);
+    CHECK(table0[1].stats.calls == 5 && table0[3].stats.calls == 3);
+
+    dispatcher.resetStats();
+    CHECK(table0[3].stats.calls == 0 && dispatcher.filterStats(2).calls == 0 && dispatcher.unhandled() == 0);
+    mcp.setDispatcher(nullptr);
+    mcp.disableInterrupts();
+
+    // routing cost on the host, the dispatcher against an if chain over the 32 ids
+    MCP2515CanPaket packets[32];
+    for(uint32_t i = 0; i < 32; i++) {
+        CHECK(sim.receive(makeFrame(ids[i], false, 8)));
+        CHECK(mcp.readMessage(packets[i]) == MCP2515Error::OK);
+    }
+    constexpr uint32_t LOOKUPS = 1000000;
+    double nsDispatch = hostNsPerLookup([&](uint32_t i) { return dispatcher.dispatch(packets[i & 31]); }, LOOKUPS);
+    double nsChain = hostNsPerLookup([&](uint32_t i) {
+        int n = idChain(ids, 32, packets[i & 31].id());
+        if(n >= 0)
+            onIdFrame(packets[i & 31]);
+        return n >= 0;
+    }, LOOKUPS);
+#ifdef MCP2515_ENABLE_DISPATCH_TIMING
+    printf("  32 ids, host ns per frame: dispatcher %.2f (timed), if chain %.2f\n", nsDispatch, nsChain);
+#else
+    printf("  32 ids, host ns per frame: dispatcher %.2f, if chain %.2f\n", nsDispatch, nsChain);
+#endif
+    CHECK(sim.overflows() == 0);
+    CHECK(sim.violations() == 0);
+}
+
+/// @brief Position of the first frame with the given id in the tx log
+int txPosition(MCP2515Sim &sim, uint32_t id) {
+    for(size_t i = 0; i < sim.txLog().size(); i++) {
+        if(sim.txLog()[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+void benchTxPriority() {
+    header("Transmit priority");
+
+    const MCP2515::TxScheduling modes[] = {MCP2515::TX_FIFO, MCP2515::TX_PRIORITY, MCP2515::TX_PRIORITY_PREEMPT};
+    const char *names[] = {"TX_FIFO", "TX_PRIORITY", "TX_PRIORITY_PREEMPT"};
+    int urgent[3];
+    for(uint8_t m = 0; m < 3; m++) {
+        host::reset();
+        MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+        MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+        CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+        mcp.setTxScheduling(modes[m]);
+        sim.setAutoTransmit(false);
+
+        // bulk frames occupy all tx buffers and the queue, then a control frame arrives
+        for(uint32_t i = 0; i < 5; i++)
+            CHECK(mcp.sendMessage(makePacket(makeFrame(0x700 + i, false, 8))) == MCP2515Error::OK);
+        {
+            Probe p(names[m]);
+            CHECK(mcp.sendMessage(makePacket(makeFrame(0x010, false, 2))) == MCP2515Error::OK);
+        }
+        while(sim.transmitNext())
+            mcp.processTxQueue();
+
+        urgent[m] = txPosition(sim, 0x010);
+        printf("  %-36s control frame sent as %d. of 6\n", "", urgent[m] + 1);
+
+        // nothing is lost or duplicated, the bulk frames stay in order
+        bool ordered = sim.txLog().size() == 6;
+        for(uint32_t i = 1; i < 5; i++)
+            ordered &= txPosition(sim, 0x700 + i - 1) < txPosition(sim, 0x700 + i);
+        CHECK(ordered);
+        CHECK(mcp.getTxQueueLength() == 0);
+        CHECK(sim.violations() == 0);
+    }
+    CHECK(urgent[0] == 5 && urgent[1] == 1 && urgent[2] == 0);
+
+    // free tx buffers: the chip has to send the more urgent of two pending frames first
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    sim.setAutoTransmit(false);
+    const uint32_t ids[] = {0x300, 0x100, 0x300, 0x200};
+    for(uint32_t id : ids)
+        CHECK(mcp.sendMessage(makePacket(makeFrame(id, false, 1))) == MCP2515Error::OK);
+    while(sim.transmitNext())
+        mcp.processTxQueue();
+    const uint32_t expected[] = {0x100, 0x200, 0x300, 0x300};
+    bool ordered = sim.txLog().size() == 4;
+    for(uint32_t i = 0; ordered && i < 4; i++)
+        ordered &= sim.txLog()[i].id == expected[i];
+    CHECK(ordered);
+
+    // a standard frame wins against an extended frame with the same base id
+    sim.txLog().clear();
+    CHECK(mcp.sendMessage(makePacket(makeFrame(0x123 << 18, true, 1))) == MCP2515Error::OK);
+    CHECK(mcp.sendMessage(makePacket(makeFrame(0x123, false, 1))) == MCP2515Error::OK);
+    while(sim.transmitNext())
+        mcp.processTxQueue();
+    CHECK(sim.txLog().size() == 2 && !sim.txLog()[0].extended);
+    CHECK(sim.violations() == 0);
+}
+
+void benchTxBackToBack() {
+    header("Back to back transmission");
+
+    // traffic of equal priority: every completion refills its buffer right away,
+    // the ranks of the pending buffers must not run out and let the pipeline drain
+    const MCP2515::TxScheduling modes[] = {MCP2515::TX_FIFO, MCP2515::TX_PRIORITY};
+    const char *names[] = {"TX_FIFO", "TX_PRIORITY"};
+    for(uint8_t m = 0; m < 2; m++) {
+        host::reset();
+        MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+        MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+        CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+        mcp.setTxScheduling(modes[m]);
+        sim.setAutoTransmit(false);
+
+        MCP2515Sim::Frame frame = makeFrame(0x100, false, 1);
+        uint32_t sent = 0;
+        auto send = [&]() {
+            frame.data[0] = static_cast<uint8_t>(sent++);
+            return mcp.sendMessage(makePacket(frame)) == MCP2515Error::OK;
+        };
+        bool full = true;
+        for(uint32_t i = 0; i < 3; i++)
+            full &= send();
+        for(uint32_t i = 0; i < 100 && sim.transmitNext(); i++) {
+            full &= send() && mcp.getTxQueueLength() == 0;
+            for(uint8_t ctrl = 0x30; ctrl <= 0x50; ctrl += 0x10)
+                full &= (sim.reg(ctrl) & 0x08) != 0;
+        }
+        while(sim.transmitNext())
+            mcp.processTxQueue();
+        printf("  %-36s %s\n", names[m], full ? "3 tx buffers pending after every frame" : "pipeline drained");
+        CHECK(full);
+
+        bool ordered = sim.txLog().size() == sent;
+        for(uint32_t i = 0; ordered && i < sent; i++)
+            ordered &= sim.txLog()[i].data[0] == static_cast<uint8_t>(i);
+        CHECK(ordered);
+        CHECK(sim.violations() == 0);
+    }
+}
+
+/// @brief TXBnCTRL address of the only pending tx buffer
+uint8_t pendingTxCtrl(MCP2515Sim &sim) {
+    for(uint8_t ctrl = 0x30; ctrl <= 0x50; ctrl += 0x10) {
+        if(sim.reg(ctrl) & 0x08)
+            return ctrl;
+    }
+    return 0;
+}
+
+void benchTxStatus() {
+    header("Transmit status");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    sim.setAutoTransmit(false);
+
+    MCP2515::TxHandle h[5];
+    CHECK(!h[0] && mcp.getTxStatus(h[0]) == MCP2515::TX_UNKNOWN);
+    CHECK(mcp.sendMessage(makePacket(makeFrame(0x100, false, 8)), h[0]) == MCP2515Error::OK && h[0]);
+    {
+        Probe p("getTxStatus(pending)");
+        CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_PENDING);
+    }
+    uint8_t ctrl = pendingTxCtrl(sim);
+    sim.setReg(ctrl, sim.reg(ctrl) | 0x20);
+    CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_LOST_ARBITRATION);
+    sim.setReg(ctrl, (sim.reg(ctrl) & ~0x20) | 0x10);
+    CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_ERROR);
+    sim.transmitNext();
+    CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_SENT);
+
+    // three pending, two queued; abort one of each
+    for(uint8_t i = 0; i < 5; i++)
+        CHECK(mcp.sendMessage(makePacket(makeFrame(0x200 + i, false, 8)), h[i]) == MCP2515Error::OK);
+    {
+        Probe p("getTxStatus(queued)");
+        CHECK(mcp.getTxStatus(h[4]) == MCP2515::TX_QUEUED);
+    }
+    CHECK(mcp.getTxStatus(h[2]) == MCP2515::TX_PENDING);
+    {
+        Probe p("abortMessage(queued)");
+        CHECK(mcp.abortMessage(h[3]) == MCP2515Error::OK);
+    }
+    {
+        Probe p("abortMessage(pending)");
+        CHECK(mcp.abortMessage(h[0]) == MCP2515Error::OK);
+    }
+    CHECK(mcp.getTxStatus(h[3]) == MCP2515::TX_ABORTED);
+    CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_ABORTED);
+    CHECK(mcp.getTxQueueLength() == 1);
+    sim.txLog().clear();
+    while(sim.transmitNext())
+        mcp.processTxQueue();
+    // the buffer of h[0] was reused for h[4], the abort is remembered
+    CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_ABORTED);
+    CHECK(mcp.getTxStatus(h[1]) == MCP2515::TX_SENT && mcp.getTxStatus(h[2]) == MCP2515::TX_SENT);
+    CHECK(mcp.getTxStatus(h[3]) == MCP2515::TX_ABORTED && mcp.getTxStatus(h[4]) == MCP2515::TX_SENT);
+    CHECK(sim.txLog().size() == 3 && mcp.abortMessage(h[4]) == MCP2515Error::FAIL);
+
+    // timeout
+    CHECK(mcp.sendMessage(makePacket(makeFrame(0x300, false, 8)), h[0]) == MCP2515Error::OK);
+    uint64_t start = host::nanos();
+    CHECK(mcp.waitTxStatus(h[0], 5) == MCP2515::TX_PENDING);
+    CHECK(host::nanos() - start >= 4000000ULL); // millis() granularity
+    sim.transmitNext();
+    CHECK(mcp.waitTxStatus(h[0], 5) == MCP2515::TX_SENT);
+
+    // one-shot failure sets ABTF, which is remembered when the buffer is reused
+    mcp.setOneShotMode(true);
+    CHECK(mcp.sendMessage(makePacket(makeFrame(0x400, false, 8)), h[0]) == MCP2515Error::OK);
+    ctrl = pendingTxCtrl(sim);
+    sim.setReg(ctrl, (sim.reg(ctrl) & ~0x08) | 0x40);
+    CHECK(mcp.waitTxStatus(h[0], 5) == MCP2515::TX_ABORTED);
+    for(uint8_t i = 1; i < 5; i++)
+        CHECK(mcp.sendMessage(makePacket(makeFrame(0x400 + i, false, 8)), h[i]) == MCP2515Error::OK);
+    CHECK(mcp.getTxStatus(h[0]) == MCP2515::TX_ABORTED);
+    mcp.setOneShotMode(false);
+
+    {
+        Probe p("abortAllMessages");
+        mcp.abortAllMessages();
+    }
+    for(uint8_t i = 1; i < 5; i++)
+        CHECK(mcp.getTxStatus(h[i]) == MCP2515::TX_ABORTED);
+    CHECK(mcp.getTxQueueLength() == 0 && !sim.transmitNext());
+
+    // handles of old messages expire
+    for(uint8_t i = 0; i < 70; i++) {
+        CHECK(mcp.sendMessage(makePacket(makeFrame(0x500, false, 0))) == MCP2515Error::OK);
+        sim.transmitNext();
+    }
+    CHECK(mcp.getTxStatus(h[1]) == MCP2515::TX_UNKNOWN);
+    CHECK(sim.violations() == 0);
+}
+
+void benchPinPolling() {
+    header("Pin gated polling");
+
+    constexpr uint8_t RX0BF_PIN = 3;
+    constexpr uint8_t RX1BF_PIN = 4;
+    const char *const names[] = {"SPI", "INT", "INT+RXnBF"};
+    constexpr uint32_t N = 100;
+    for(uint8_t variant = 0; variant < 3; variant++) {
+        host::reset();
+        MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+        sim.setBufferFullPins(RX0BF_PIN, RX1BF_PIN);
+        MCP2515 mcp(CS_PIN, MCP2515::MCP_8MHZ);
+        if(variant == 1)
+            mcp.setPollingPins(INT_PIN);
+        else if(variant == 2)
+            mcp.setPollingPins(INT_PIN, RX0BF_PIN, RX1BF_PIN);
+        CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+        CHECK(sim.reg(0x0C) == (variant == 2 ? 0x0F : 0x00));
+
+        char name[64];
+        MCP2515CanPaket packet;
+        snprintf(name, sizeof(name), "checkMessage(idle, %s)", names[variant]);
+        {
+            Probe p(name, N);
+            for(uint32_t i = 0; i < N; i++)
+                CHECK(!mcp.checkMessage());
+        }
+        snprintf(name, sizeof(name), "readMessage(idle, %s)", names[variant]);
+        {
+            Probe p(name, N);
+            for(uint32_t i = 0; i < N; i++)
+                CHECK(mcp.readMessage(packet) == MCP2515Error::NOMSG);
+        }
+        snprintf(name, sizeof(name), "check+read(8 bytes, %s)", names[variant]);
+        {
+            Probe p(name, N);
+            for(uint32_t i = 0; i < N; i++) {
+                CHECK(sim.receive(makeFrame(0x100 + i, false, 8)));
+                CHECK(mcp.checkMessage());
+                CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.id() == 0x100 + i);
+            }
+        }
+        CHECK(host::pinLevel(RX0BF_PIN) == HIGH && host::pinLevel(RX1BF_PIN) == HIGH);
+
+        // RX1BF follows the second buffer
+        mcp.setRxBufferRollover(true);
+        MCP2515CanPaket packets[2];
+        CHECK(sim.receive(makeFrame(0x300, false, 1)) && sim.receive(makeFrame(0x301, false, 2)));
+        CHECK(variant != 2 || (host::pinLevel(RX0BF_PIN) == LOW && host::pinLevel(RX1BF_PIN) == LOW));
+        CHECK(mcp.readMessages(packets, 2) == 2 && packets[0].id() == 0x300 && packets[1].id() == 0x301);
+
+        // a completed transmission does not pull INT low, unless messages wait in the tx queue
+        sim.setAutoTransmit(false);
+        CHECK(mcp.sendMessage(makePacket(makeFrame(0x123, false, 8))) == MCP2515Error::OK);
+        sim.transmitNext();
+        CHECK(host::pinLevel(INT_PIN) == HIGH);
+        snprintf(name, sizeof(name), "checkMessage(tx done, %s)", names[variant]);
+        {
+            Probe p(name);
+            CHECK(!mcp.checkMessage());
+        }
+        for(int i = 0; i < 4; i++)
+            CHECK(mcp.sendMessage(makePacket(makeFrame(0x124 + i, false, 8))) == MCP2515Error::OK);
+        CHECK(mcp.getTxQueueLength() == 1);
+        sim.transmitNext();
+        CHECK(host::pinLevel(INT_PIN) == LOW);
+        mcp.processTxQueue();
+        CHECK(mcp.getTxQueueLength() == 0 && host::pinLevel(INT_PIN) == HIGH);
+        while(sim.transmitNext()) { }
+        CHECK(host::pinLevel(INT_PIN) == HIGH && !mcp.checkMessage());
+
+        // with the INT pin, polling services the tx queue and INT does not stay low
+        for(int i = 0; i < 4; i++)
+            CHECK(mcp.sendMessage(makePacket(makeFrame(0x130 + i, false, 8))) == MCP2515Error::OK);
+        sim.transmitNext();
+        CHECK(host::pinLevel(INT_PIN) == LOW);
+        snprintf(name, sizeof(name), "checkMessage(tx queued, %s)", names[variant]);
+        {
+            Probe p(name);
+            CHECK(!mcp.checkMessage());
+        }
+        CHECK(variant == 0 || (mcp.getTxQueueLength() == 0 && host::pinLevel(INT_PIN) == HIGH));
+        mcp.processTxQueue();
+        while(sim.transmitNext()) { }
+        CHECK(sim.txLog().size() == 9 && host::pinLevel(INT_PIN) == HIGH);
+        CHECK(sim.violations() == 0);
+    }
+}
+
+uint32_t g_received = 0;
+
+void benchRxInterrupt() {
+    header("Receive queue (INT driven)");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_16MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_1000KBPS) == MCP2515Error::OK);
+
+    // polled: a busy loop that does not read for three frame times loses frames
+    for(uint32_t i = 0; i < 3; i++)
+        sim.receive(makeFrame(0x100 + i, false, 8));
+    const uint32_t lost = sim.overflows();
+    CHECK(lost > 0);
+    MCP2515CanPaket packet;
+    while(mcp.readMessage(packet) == MCP2515Error::OK) { }
+    mcp.clearErrorFlags();
+
+    g_received = 0;
+    mcp.onReceivePacket([](const MCP2515CanPaket &packet) {
+        CHECK(packet.id() == 0x200 + g_received);
+        g_received++;
+    });
+
+    constexpr uint32_t N = 100;
+    {
+        Probe p("frame received by INT handler", N);
+        for(uint32_t i = 0; i < N; i++) {
+            CHECK(sim.receive(makeFrame(0x200 + i, false, 8)));
+            if(i % MCP2515_CANPACKET_RX_QUEUE_SIZE == MCP2515_CANPACKET_RX_QUEUE_SIZE - 1)
+                mcp.processRxQueue();
+        }
+        mcp.processRxQueue();
+    }
+    CHECK(g_received == N);
+    CHECK(sim.overflows() == lost);
+    CHECK(host::pinLevel(INT_PIN) == HIGH);
+
+    mcp.disableInterrupts();
+    CHECK(sim.violations() == 0);
+}
+
+uint32_t g_transportReceived = 0;
+
+void benchTransport() {
+    header("Transport (16MHz, 1Mbit/s)");
+
+    // the default SPIClass transport, the simulated chip as transport and the same with DMA like transfers
+    const char *const names[] = {"SPIClass", "sim", "sim, async"};
+    constexpr uint32_t N = 100;
+    for(uint8_t variant = 0; variant < 3; variant++) {
+        host::reset();
+        MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+        MCP2515SimTransport transport(sim);
+        transport.setAsync(variant == 2);
+        MCP2515 spiDriver(CS_PIN, MCP2515::MCP_16MHZ);
+        MCP2515Driver simDriver(transport, MCP2515::MCP_16MHZ);
+        MCP2515Driver &mcp = variant ? simDriver : spiDriver;
+        CHECK(mcp.begin(MCP2515::CAN_1000KBPS) == MCP2515Error::OK);
+
+        char name[64];
+        const auto std8 = makeFrame(0x123, false, 8);
+        snprintf(name, sizeof(name), "sendMessage (%s)", names[variant]);
+        {
+            Probe p(name, N);
+            for(uint32_t i = 0; i < N; i++)
+                CHECK(mcp.sendMessage(makePacket(std8)) == MCP2515Error::OK);
+        }
+        CHECK(sim.txLog().size() == N && sim.txLog().back() == std8);
+
+        g_transportReceived = 0;
+        mcp.onReceivePacket([](const MCP2515CanPaket &packet) {
+            CHECK(packet.id() == 0x200 + g_transportReceived && packet.dlc() == 8 && packet.data()[7] == 0xA7);
+            g_transportReceived++;
+        });
+        snprintf(name, sizeof(name), "frame received by INT (%s)", names[variant]);
+        {
+            Probe p(name, N);
+            for(uint32_t i = 0; i < N; i++) {
+                CHECK(sim.receive(makeFrame(0x200 + i, false, 8)));
+                // the DMA complete interrupt
+                transport.finish();
+                if(i % MCP2515_CANPACKET_RX_QUEUE_SIZE == MCP2515_CANPACKET_RX_QUEUE_SIZE - 1)
+                    mcp.processRxQueue();
+            }
+            mcp.processRxQueue();
+        }
+        CHECK(g_transportReceived == N);
+        CHECK(host::pinLevel(INT_PIN) == HIGH);
+        if(variant == 2)
+            CHECK(transport.asyncTransfers() == 2 * N);
+
+        mcp.disableInterrupts();
+        CHECK(sim.violations() == 0);
+    }
+}
+
+/// @brief Per frame costs of a driver at 16MHz, 1Mbit/s and 10MHz SPI
+struct FrameCosts {
+    uint64_t beginNs;
+    uint64_t sendNs;
+    uint64_t readNs;
+};
+
+template<class Driver>
+FrameCosts measureFrames(Driver &mcp, MCP2515Error (*begin)(Driver &), const char *name) {
+    FrameCosts costs{};
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    char label[64];
+
+    uint64_t start = host::nanos();
+    CHECK(begin(mcp) == MCP2515Error::OK);
+    costs.beginNs = host::nanos() - start;
+    constexpr BitTiming timing = calcBitTiming(16000000, 1000000);
+    CHECK(sim.reg(0x2A) == timing.cnf1 && sim.reg(0x29) == timing.cnf2 && sim.reg(0x28) == timing.cnf3);
+
+    constexpr uint32_t N = 100;
+    const auto std8 = makeFrame(0x123, false, 8);
+    snprintf(label, sizeof(label), "sendMessage (%s)", name);
+    {
+        Probe p(label, N);
+        start = host::nanos();
+        for(uint32_t i = 0; i < N; i++)
+            CHECK(mcp.sendMessage(makePacket(std8)) == MCP2515Error::OK);
+        costs.sendNs = (host::nanos() - start) / N;
+    }
+    CHECK(sim.txLog().size() == N && sim.txLog().back() == std8);
+
+    snprintf(label, sizeof(label), "readMessage (%s)", name);
+    {
+        Probe p(label, N);
+        uint64_t ns = 0;
+        for(uint32_t i = 0; i < N; i++) {
+            CHECK(sim.receive(makeFrame(0x200 + i, false, 8)));
+            MCP2515CanPaket packet;
+            start = host::nanos();
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.id() == 0x200 + i);
+            ns += host::nanos() - start;
+        }
+        costs.readNs = ns / N;
+    }
+    CHECK(sim.violations() == 0);
+    return costs;
+}
+
+void benchTemplate() {
+    header("Compile-time driver (16MHz, 1Mbit/s, 10MHz SPI)");
+
+    host::reset();
+    MCP2515 runtime(CS_PIN, MCP2515::MCP_16MHZ);
+    runtime.setSPIFrequency(10000000);
+    FrameCosts a = measureFrames<MCP2515>(runtime, [](MCP2515 &mcp) {
+        return mcp.begin(MCP2515::CAN_1000KBPS);
+    }, "MCP2515");
+
+    host::reset();
+    MCP2515T<CS_PIN, MCP2515::MCP_16MHZ, 10000000> fixed;
+    FrameCosts b = measureFrames<decltype(fixed)>(fixed, [](decltype(fixed) &mcp) {
+        return mcp.begin<1000000>();
+    }, "MCP2515T");
+
+    // cycles of a 16MHz AVR saved per call
+    auto cycles = [](uint64_t from, uint64_t to) { return (static_cast<int64_t>(from) - static_cast<int64_t>(to)) * 16 / 1000; };
+    printf("  saved per call: begin %" PRId64 ", sendMessage %" PRId64 ", readMessage %" PRId64 " cycles\n",
+        cycles(a.beginNs, b.beginNs), cycles(a.sendNs, b.sendNs), cycles(a.readNs, b.readNs));
+    CHECK(b.sendNs < a.sendNs && b.readNs < a.readNs);
+
+    // only the driver with the default transport carries a SPITransport
+    printf("  size: MCP2515 %zu, MCP2515T %zu, MCP2515Driver %zu bytes\n", sizeof(MCP2515), sizeof(fixed), sizeof(MCP2515Driver));
+    CHECK(sizeof(MCP2515) == sizeof(MCP2515Driver) + sizeof(SPITransport));
+}
+
+void checkLoopback() {
+    header("Loopback");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_16MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_125KBPS) == MCP2515Error::OK);
+    CHECK(mcp.setLoopbackMode() == MCP2515Error::OK);
+
+    const MCP2515Sim::Frame frames[] = {
+        makeFrame(0x000, false, 0), makeFrame(0x7FF, false, 8),
+        makeFrame(0x1FFFFFFF, true, 3), makeFrame(0x00040000, true, 8),
+    };
+    for(const auto &f : frames) {
+        MCP2515CanPaket packet;
+        {
+            Probe p("loopback round trip");
+            CHECK(mcp.sendMessage(makePacket(f)) == MCP2515Error::OK);
+            CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+        }
+        CHECK(samePacket(packet, f));
+    }
+    CHECK(sim.violations() == 0);
+}
+
+#ifdef MCP2515_ENABLE_STATISTICS
+void benchStatistics() {
+    header("Driver statistics");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_16MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    mcp.resetStatistics();
+
+    // the counters have to agree with the bus
+    const host::SpiStats spiBefore = host::spiStats();
+    const auto f = makeFrame(0x123, false, 8);
+    for(int i = 0; i < 5; i++)
+        CHECK(mcp.sendMessage(makePacket(f)) == MCP2515Error::OK);
+    MCP2515CanPaket packet;
+    for(int i = 0; i < 3; i++) {
+        CHECK(sim.receive(makeFrame(0x200 + i, false, 8)));
+        CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    }
+    MCP2515::Statistics stats = mcp.getStatistics();
+    CHECK(stats.txFrames[0] + stats.txFrames[1] + stats.txFrames[2] == 5);
+    CHECK(stats.rxFrames[0] + stats.rxFrames[1] == 3);
+    CHECK(stats.spiTransactions == host::spiStats().transactions - spiBefore.transactions);
+    CHECK(stats.spiBytes == host::spiStats().bytes - spiBefore.bytes);
+    CHECK(stats.txBusy == 0 && stats.rxDropped == 0);
+
+    // an overflow is counted once until the flags are cleared, no matter how many frames were lost
+    for(int i = 0; i < 3; i++)
+        sim.receive(makeFrame(0x300 + i, false, 8));
+    CHECK(sim.overflows() > 1);
+    mcp.getErrorFlags();
+    mcp.getErrorFlags();
+    stats = mcp.getStatistics();
+    CHECK(stats.rxOverflows[0] + stats.rxOverflows[1] == 1);
+    CHECK(stats.errors == 1);
+    while(mcp.readMessage(packet) == MCP2515Error::OK) { }
+    mcp.clearErrorFlags();
+    for(int i = 0; i < 3; i++)
+        sim.receive(makeFrame(0x300 + i, false, 8));
+    mcp.getErrorFlags();
+    stats = mcp.getStatistics();
+    CHECK(stats.rxOverflows[0] + stats.rxOverflows[1] == 2);
+    CHECK(stats.errors == 2);
+    while(mcp.readMessage(packet) == MCP2515Error::OK) { }
+    mcp.clearErrorFlags();
+
+    // a full rx queue drops messages
+    mcp.resetStatistics();
+    mcp.onReceivePacket([](const MCP2515CanPaket &) { });
+    constexpr uint32_t N = MCP2515_CANPACKET_RX_QUEUE_SIZE + 2;
+    for(uint32_t i = 0; i < N; i++)
+        CHECK(sim.receive(makeFrame(0x400 + i, false, 8)));
+    {
+        Probe p("getStatistics()");
+        stats = mcp.getStatistics();
+    }
+    CHECK(stats.rxFrames[0] + stats.rxFrames[1] == N);
+    CHECK(stats.rxDropped == 2);
+    CHECK(stats.rxQueuePeak == MCP2515_CANPACKET_RX_QUEUE_SIZE);
+    // the queued messages are kept, the later ones are dropped
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.id() == 0x400);
+    mcp.processRxQueue();
+    mcp.disableInterrupts();
+
+    // frames the tx buffers and the tx queue can't take are rejected
+    mcp.resetStatistics();
+    sim.setAutoTransmit(false);
+    uint32_t rejected = 0;
+    for(uint32_t i = 0; i < 3 + MCP2515_CANPACKET_TX_QUEUE_SIZE + 4; i++)
+        rejected += mcp.sendMessage(makePacket(f)) != MCP2515Error::OK;
+    stats = mcp.getStatistics();
+    CHECK(stats.txBusy == rejected && rejected == 4);
+    CHECK(stats.txQueuePeak == MCP2515_CANPACKET_TX_QUEUE_SIZE);
+    printf("  tx burst: %u loaded, %u queued, %u rejected, %u SPI transactions, %u SPI bytes\n",
+        (unsigned)(stats.txFrames[0] + stats.txFrames[1] + stats.txFrames[2]), (unsigned)stats.txQueuePeak,
+        (unsigned)stats.txBusy, (unsigned)stats.spiTransactions, (unsigned)stats.spiBytes);
+
+    mcp.resetStatistics();
+    stats = mcp.getStatistics();
+    CHECK(stats.txBusy == 0 && stats.spiTransactions == 0 && stats.txQueuePeak == 0);
+    CHECK(sim.violations() == 0);
+}
+#endif
+
+#ifdef MCP2515_ENABLE_SPI_TRACE
+/// @brief The simulated chip on a bus shared with another device, which holds the bus for a while
+class SharedBusTransport : public MCP2515SimTransport {
+public:
+    using MCP2515SimTransport::MCP2515SimTransport;
+
+    void select() override {
+        host::advance(uint64_t(holdMicros) * 1000);
+        holdMicros = 0;
+        MCP2515SimTransport::select();
+    }
+
+    uint32_t holdMicros{0};
+};
+
+void benchSpiTrace() {
+    header("SPI trace");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    SharedBusTransport transport(sim);
+    MCP2515Driver mcp(transport, MCP2515::MCP_16MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_1000KBPS) == MCP2515Error::OK);
+
+    MCP2515CanPaket packet;
+    CHECK(sim.receive(makeFrame(0x123, false, 8)));
+    {
+        Probe p("readMessage (no trace)");
+        CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    }
+
+    SpiTrace trace;
+    mcp.setSpiTrace(&trace);
+    CHECK(sim.receive(makeFrame(0x124, false, 8)));
+    {
+        Probe p("readMessage (traced)");
+        CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    }
+    // RX STATUS, then READ RX BUFFER 0 with the whole frame
+    CHECK(trace.size() == 2 && trace.count() == 2);
+    CHECK(trace[0].instruction == 0xB0 && trace[0].length == 2);
+    CHECK(trace[1].instruction == 0x90 && trace[1].length == 1 + 5 + 8 && !trace[1].async);
+    CHECK(trace[1].start >= trace[0].start + trace[0].latency());
+
+    // another device holds the bus, the wait shows up in the record and in the histogram
+    CHECK(sim.receive(makeFrame(0x125, false, 8)));
+    transport.holdMicros = 300;
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    CHECK(trace[2].wait >= 300 && trace[3].wait < 300);
+    CHECK(trace.histogram(SpiTrace::bin(trace[2].latency())) == 1);
+    CHECK(SpiTrace::bin(0) == 0 && SpiTrace::bin(1) == 1 && SpiTrace::bin(300) == 9 && SpiTrace::bin(0xFFFFFFFF) == SpiTrace::nBins - 1);
+
+    // register helpers, the ring keeps the newest records
+    while(trace.count() < 2 * MCP2515_SPI_TRACE_SIZE)
+        mcp.getErrorFlags();
+    CHECK(trace.size() == MCP2515_SPI_TRACE_SIZE);
+    bool ordered = true;
+    for(uint8_t i = 1; i < trace.size(); i++)
+        ordered &= trace[i].start >= trace[i - 1].start && trace[i].instruction == 0x03;
+    CHECK(ordered);
+    uint32_t binned = 0;
+    printf("  latency histogram:");
+    for(uint8_t b = 0; b < SpiTrace::nBins; b++) {
+        binned += trace.histogram(b);
+        if(trace.histogram(b))
+            printf(" [%u..%uus] %u", b ? 1u << (b - 1) : 0u, b ? (1u << b) - 1 : 0u, (unsigned)trace.histogram(b));
+    }
+    printf("\n");
+    CHECK(binned == trace.count());
+
+    // nothing is recorded without a trace
+    const uint32_t recorded = trace.count();
+    mcp.setSpiTrace(nullptr);
+    mcp.getErrorFlags();
+    CHECK(trace.count() == recorded);
+    trace.clear();
+    CHECK(trace.size() == 0 && trace.count() == 0 && trace.histogram(SpiTrace::bin(300)) == 0);
+    CHECK(sim.violations() == 0);
+}
+#endif
+
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+constexpr uint8_t SOF_PIN = 5;
+
+uint32_t sofPulse() {
+    const uint32_t at = micros();
+    host::setPinLevel(SOF_PIN, HIGH);
+    host::setPinLevel(SOF_PIN, LOW);
+    return at;
+}
+
+void benchRxTimestamp() {
+    header("RX timestamps (16MHz, 500kbit/s)");
+
+    host::reset();
+    MCP2515Sim sim(SPI, CS_PIN, INT_PIN);
+    MCP2515 mcp(CS_PIN, MCP2515::MCP_16MHZ);
+    CHECK(mcp.begin(MCP2515::CAN_500KBPS) == MCP2515Error::OK);
+    const auto std8 = makeFrame(0x123, false, 8);
+    MCP2515CanPaket packet;
+
+    // polled: the message is timestamped when it is found
+    CHECK(sim.receive(std8));
+    host::advance(300000);
+    const uint32_t polledAt = micros();
+    {
+        Probe p("readMessage (polled, timestamped)");
+        CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    }
+    CHECK(packet.getRxTimestamp() - polledAt < 20);
+    CHECK(packet.getDequeueTimestamp() >= packet.getRxTimestamp() && packet.getLatency() < 100);
+
+    // a message left in RXB1 keeps the time of the poll which found it
+    mcp.setRxBufferRollover(true);
+    CHECK(sim.receive(std8) && sim.receive(makeFrame(0x124, false, 8)));
+    const uint32_t foundAt = micros();
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.getRxBuffer() == 0);
+    host::advance(300000);
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK && packet.getRxBuffer() == 1);
+    CHECK(packet.getRxTimestamp() - foundAt < 20 && packet.getLatency() >= 300);
+    mcp.setRxBufferRollover(false);
+
+    // interrupt mode: timestamped at the INT edge, the time in the queue is the latency
+    mcp.enableInterrupts();
+    const uint32_t edge = micros();
+    CHECK(sim.receive(std8));
+    host::advance(500000);
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    CHECK(packet.getRxTimestamp() - edge < 10);
+    // the INT handler reads the message after the timestamp
+    CHECK(packet.getLatency() >= 500 && packet.getLatency() < 600);
+
+    // start of frame on CLKOUT, a standard frame with 8 data bytes takes 111 bits or more
+    mcp.setClockOut(MCP2515::CLKOUT_SOF);
+    CHECK((sim.reg(0x0F) & 0x04) && (sim.reg(0x28) & 0x80));
+    host::setPinLevel(SOF_PIN, LOW);   // idle level of the SOF signal
+    mcp.setSofPin(SOF_PIN);
+    uint32_t sof = sofPulse();
+    host::advance(111 * 2000);
+    CHECK(sim.receive(std8));
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    CHECK(packet.getRxTimestamp() - sof <= 2);
+
+    // the INT handler is late, the next frame already started
+    sof = sofPulse();
+    host::advance(111 * 2000);
+    noInterrupts();
+    CHECK(sim.receive(std8));
+    host::advance(20000);
+    sofPulse();
+    interrupts();
+    CHECK(mcp.readMessage(packet) == MCP2515Error::OK);
+    CHECK(packet.getRxTimestamp() - sof <= 2);
+    printf("  stamped at the SOF %u us before the dequeue, the INT handler ran 20 us late\n", (unsigned)packet.getLatency());
+    mcp.setSofPin(-1);
+
+    // latency and jitter per id of a cyclic message, the period alternates by 20us
+    RxLatency::Entry table[2];
+    RxLatency latency(table, 2);
+    constexpr uint32_t N = 50;
+    for(uint32_t i = 0; i < N; i++) {
+        CHECK(sim.receive(std8));
+        CHECK(sim.receive(makeFrame(0x1FFFFFFF, true, 2)));
+        CHECK(sim.receive(makeFrame(0x200 + (i & 1), false, 1)));
+        host::advance(i * 37000 % 400000);
+        while(mcp.readMessage(packet) == MCP2515Error::OK)
+            latency.add(packet);
+        host::advance(1000000 + (i & 1 ? 10000 : -10000) - i * 37000 % 400000);
+    }
+    mcp.disableInterrupts();
+
+    const RxLatency::Entry *entry = latency.find(0x123);
+    CHECK(entry && entry->count == N);
+    CHECK(latency.find(0x1FFFFFFF, true) && !latency.find(0x1FFFFFFF) && !latency.find(0x200));
+    CHECK(latency.untracked() == N);
+    if(entry) {
+        // the INT handler reads all three messages, the polling delay of up to 400us comes on top
+        CHECK(entry->periodSpread() >= 20 && entry->periodSpread() < 25);
+        CHECK(entry->maxLatency >= 400 && entry->maxLatency < 600);
+        uint32_t binned = 0;
+        printf("  0x123 latency:");
+        for(uint8_t b = 0; b < RxLatency::Histogram::nBins; b++) {
+            binned += entry->latency[b];
+            if(entry->latency[b])
+                printf(" [%u us..] %u", (unsigned)RxLatency::Histogram::lowerBound(b), (unsigned)entry->latency[b]);
+        }
+        printf(", period %u..%u us\n", (unsigned)entry->minPeriod, (unsigned)entry->maxPeriod);
+        CHECK(binned == N);
+        CHECK(entry->jitter[RxLatency::Histogram::bin(20)] >= N - 3);
+    }
+    latency.clear();
+    CHECK(!latency.find(0x123) && latency.untracked() == 0);
+    CHECK(sim.violations() == 0);
+}
+#endif
+
+} // namespace
+
+int main() {
+    printf("MCP2515 host simulator benchmark (16MHz AVR cost model, 4MHz SPI)\n");
+
+    benchInit();
+    benchBoot();
+    benchModeChange();
+    benchBitTiming();
+    benchFilterPlanner();
+    benchTx();
+    benchTxQueue();
+    benchTxPriority();
+    benchTxBackToBack();
+    benchTxStatus();
+    benchRx();
+    benchSoftwareFilter();
+    benchDispatcher();
+    benchPinPolling();
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    benchRegisterShadow();
+    benchRegisterBatch();
+#endif
+    benchRxInterrupt();
+    benchTransport();
+    benchTemplate();
+#ifdef MCP2515_ENABLE_STATISTICS
+    benchStatistics();
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    benchSpiTrace();
+#endif
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    benchRxTimestamp();
+#endif
+    checkLoopback();
+
+    printf("\n%s (%d failed checks)\n", g_failures ? "FAILED" : "OK", g_failures);
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define LOW_LEVEL 0
+#define CHANGE    1
+#define FALLING   2
+#define RISING    3
+
+#define DEC 10
+#define HEX 16
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#define digitalPinToInterrupt(p) (p)
+
+// AVR style direct port access: 8 pins per port, the output register drives the pins in OUTPUT mode
+#define digitalPinToPort(p) ((p) / 8)
+#define digitalPinToBitMask(p) (static_cast<uint8_t>(1 << ((p) % 8)))
+#define portOutputRegister(port) (host::portRegister(port))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void attachInterrupt(uint8_t interruptNum, void (*isr)(), int mode);
+void detachInterrupt(uint8_t interruptNum);
+void noInterrupts();
+void interrupts();
+
+/// @brief Host side controls of the simulated Arduino core
+namespace host {
+
+static constexpr uint8_t NUM_PINS = 64;
+
+/// @brief Approximate costs of core functions on a 16MHz AVR, used to advance the simulated clock
+struct Costs {
+    uint32_t digitalWriteNs{3000};      ///< digitalWrite() call
+    uint32_t digitalReadNs{2500};       ///< digitalRead() call
+    uint32_t transactionNs{1000};       ///< SPI beginTransaction() + endTransaction() pair
+    uint32_t byteOverheadNs{500};       ///< software overhead per transferred SPI byte
+    uint32_t blockByteOverheadNs{125};  ///< software overhead per byte of a SPI block transfer
+    uint32_t timeQueryNs{1000};         ///< millis()/micros() call
+};
+
+/// @brief Counters of the simulated SPI bus
+struct SpiStats {
+    uint32_t transactions{0};
+    uint32_t bytes{0};
+};
+
+Costs &costs();
+
+/// @brief Simulated time since power on in nanoseconds
+uint64_t nanos();
+
+/// @brief Advance the simulated clock
+void advance(uint64_t ns);
+
+/// @brief Set the simulated clock, f.e. to test millis() wraparound
+void setNanos(uint64_t ns);
+
+/// @brief Current level of a pin
+uint8_t pinLevel(uint8_t pin);
+
+/// @brief Output register of a port, see portOutputRegister()
+volatile uint8_t *portRegister(uint8_t port);
+
+/// @brief Drive an input pin from a simulated peripheral, triggers attached interrupts
+void setPinLevel(uint8_t pin, uint8_t level);
+
+/// @brief Run all pending interrupt service routines, if interrupts are enabled
+void deliverInterrupts();
+
+/// @brief Mask or unmask pin interrupts (used by SPIClass::usingInterrupt())
+void maskInterrupts(bool mask);
+
+SpiStats &spiStats();
+
+/// @brief Reset time, pins, interrupts and counters
+void reset();
+
+} // namespace host
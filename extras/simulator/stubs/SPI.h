@@ -0,0 +1,83 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SPI_HAS_TRANSACTION 1
+#define SPI_HAS_NOTUSINGINTERRUPT 1
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPISettings {
+public:
+    SPISettings() = default;
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) { }
+
+    uint32_t clock{4000000};
+    uint8_t bitOrder{MSBFIRST};
+    uint8_t dataMode{SPI_MODE0};
+};
+
+namespace host {
+
+/// @brief A simulated SPI peripheral
+class SpiDevice {
+public:
+    virtual ~SpiDevice() = default;
+
+    /// @brief Sample the chip select line and react on edges
+    virtual void spiSync() = 0;
+
+    /// @brief Is the device selected by its chip select line
+    virtual bool spiSelected() const = 0;
+
+    /// @brief Exchange one byte with the device
+    virtual uint8_t spiTransfer(uint8_t data) = 0;
+};
+
+} // namespace host
+
+class SPIClass {
+public:
+    void begin() { }
+    void end() { }
+
+    void beginTransaction(SPISettings settings);
+    void endTransaction();
+
+    uint8_t transfer(uint8_t data);
+    uint16_t transfer16(uint16_t data);
+    void transfer(void *buf, size_t count);
+
+    void usingInterrupt(int interruptNumber) { (void)interruptNumber; _usingInterrupt = true; }
+    void notUsingInterrupt(int interruptNumber) { (void)interruptNumber; _usingInterrupt = false; }
+
+    /// @brief Connect a simulated peripheral to the bus
+    void attach(host::SpiDevice *device);
+
+    /// @brief Disconnect a simulated peripheral from the bus
+    void detach(host::SpiDevice *device);
+
+private:
+    void sync();
+    uint8_t exchange(uint8_t data);
+
+    static constexpr size_t MAX_DEVICES = 4;
+    host::SpiDevice *_devices[MAX_DEVICES]{};
+    SPISettings _settings;
+    bool _usingInterrupt{false};
+    bool _inTransaction{false};
+};
+
+extern SPIClass SPI;
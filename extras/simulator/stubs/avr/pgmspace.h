@@ -0,0 +1,14 @@
+/**
+ * CAN MCP2515_nb - host simulator
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <cstdint>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr) (*(addr))
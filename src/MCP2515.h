@@ -13,6 +13,10 @@
 #endif
 
 #include "MCP2515/MCP2515.h"
+#include "MCP2515/MCP2515T.hpp"
+#include "MCP2515/FrameDispatcher.hpp"
+#include "MCP2515/SpiTrace.hpp"
+#include "MCP2515/RxLatency.hpp"
 #include "MCP2515/CANPacket.hpp"
 
 #endif
@@ -0,0 +1,179 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stdint.h>
+
+/// @brief CNF1..CNF3 register values for a CAN bitrate, see chapter 5 of the MCP2515 datasheet
+struct BitTiming {
+    uint8_t cnf1{0};
+    uint8_t cnf2{0};
+    uint8_t cnf3{0};
+
+    uint32_t bitrate{0};        ///< achieved bitrate in bit/s, 0 if no valid timing was found
+    uint16_t samplePoint{0};    ///< achieved sample point in 1/1000 of the bit time
+
+    constexpr BitTiming() { }
+    constexpr BitTiming(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3, uint32_t bitrate, uint16_t samplePoint) :
+        cnf1(cnf1), cnf2(cnf2), cnf3(cnf3), bitrate(bitrate), samplePoint(samplePoint) { }
+
+    constexpr bool valid() const { return bitrate != 0; }
+    constexpr explicit operator bool() const { return valid(); }
+};
+
+namespace internal {
+
+static constexpr uint8_t BIT_TQ_MIN = 5;
+static constexpr uint8_t BIT_TQ_MAX = 25;
+static constexpr uint8_t BIT_BRP_MAX = 64;
+static constexpr uint8_t BIT_SEG_MAX = 8;
+static constexpr uint8_t BIT_PS2_MIN = 2;
+static constexpr uint8_t BIT_SJW_MAX = 4;
+
+/// Largest accepted deviation of the achieved bitrate, in 1/10000
+static constexpr uint32_t BIT_RATE_TOLERANCE = 50;
+
+static constexpr uint32_t absDiff(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
+
+static constexpr uint8_t maxOf(uint8_t a, uint8_t b) {
+    return a > b ? a : b;
+}
+
+// The bit timing functions are C++11 constexpr (a single return statement each), so that
+// calcBitTiming() is evaluated at compile time on the AVR core (-std=gnu++11) as well.
+
+/// @brief Returns the register values of a bit with the given segments
+static constexpr BitTiming segmentTiming(uint32_t oscillator, uint8_t brp, uint8_t n, uint8_t sjw, uint8_t prop, uint8_t ps1, uint8_t ps2) {
+    return BitTiming(((sjw - 1) << 6) | (brp - 1),
+        0x80 | ((ps1 - 1) << 3) | (prop - 1),       // BTLMODE: PS2 is set by CNF3
+        ps2 - 1,
+        (oscillator / 2 + static_cast<uint32_t>(brp) * n / 2) / (static_cast<uint32_t>(brp) * n),
+        (1000UL * (n - ps2) + n / 2) / n);
+}
+
+/// @brief Split PropSeg + PS1 (tseg1), PS1 takes the larger half but at least SJW
+static constexpr BitTiming splitTseg1(uint32_t oscillator, uint8_t brp, uint8_t n, uint8_t sjw, uint8_t ps2, uint8_t ps1) {
+    return (n - 1 - ps2 - ps1 >= 1 && n - 1 - ps2 - ps1 <= BIT_SEG_MAX) ?
+        segmentTiming(oscillator, brp, n, sjw, n - 1 - ps2 - ps1, ps1, ps2) : BitTiming();
+}
+
+/// @brief Split a bit of n time quanta with a given PS2
+static constexpr BitTiming splitPs2(uint32_t oscillator, uint8_t brp, uint8_t n, uint8_t sjw, uint8_t ps2) {
+    return (ps2 <= BIT_SEG_MAX && n - 1 - ps2 >= ps2) ?
+        splitTseg1(oscillator, brp, n, sjw, ps2, maxOf((n - 1 - ps2) - (n - 1 - ps2) / 2, sjw)) : BitTiming();
+}
+
+/// @brief Returns PS2 for a sample point: at least 2, longer than SJW and long enough for PropSeg + PS1 <= 16
+static constexpr uint8_t phaseSeg2(uint8_t n, uint16_t samplePoint, uint8_t sjw) {
+    return maxOf(maxOf((n * (1000 - samplePoint) + 500) / 1000, maxOf(BIT_PS2_MIN, sjw + 1)),
+        n > 1 + 2 * BIT_SEG_MAX ? n - 1 - 2 * BIT_SEG_MAX : 0);
+}
+
+/// @brief Split a bit of n time quanta into segments
+/// Sync (1) + PropSeg (1..8) + PS1 (1..8) + PS2 (2..8), with PropSeg + PS1 >= PS2, SJW <= PS1 and SJW < PS2
+static constexpr BitTiming splitBitTime(uint32_t oscillator, uint8_t brp, uint8_t n, uint16_t samplePoint, uint8_t sjw) {
+    return splitPs2(oscillator, brp, n, sjw, phaseSeg2(n, samplePoint, sjw));
+}
+
+/// @brief Returns the deviation of a timing from the bitrate in 1/10000
+/// 32 bit only, so that a run time call does not pull in a 64 bit division. A deviation that would
+/// overflow is far beyond the tolerance anyway.
+static constexpr uint32_t rateError(const BitTiming &timing, uint32_t bitrate) {
+    return absDiff(timing.bitrate, bitrate) > 0xFFFFFFFFUL / 10000 ? 0xFFFFFFFFUL :
+        10000UL * absDiff(timing.bitrate, bitrate) / bitrate;
+}
+
+/// @brief Returns the better of two timings: the one closer to the bitrate, then to the sample point
+/// A candidate off the bitrate by more than the tolerance is never taken.
+static constexpr BitTiming betterTiming(const BitTiming &best, const BitTiming &candidate, uint32_t bitrate, uint16_t samplePoint) {
+    return (candidate && rateError(candidate, bitrate) <= BIT_RATE_TOLERANCE &&
+            (!best || rateError(candidate, bitrate) < rateError(best, bitrate) ||
+             (rateError(candidate, bitrate) == rateError(best, bitrate) &&
+              absDiff(candidate.samplePoint, samplePoint) < absDiff(best.samplePoint, samplePoint)))) ?
+        candidate : best;
+}
+
+/// @brief Returns the timing of a bit of n time quanta, bit time = n * TQ = n * 2 * BRP / Fosc
+static constexpr BitTiming candidateTiming(uint32_t oscillator, uint16_t samplePoint, uint8_t sjw, uint8_t n, uint32_t brp) {
+    return (brp >= 1 && brp <= BIT_BRP_MAX) ? splitBitTime(oscillator, brp, n, samplePoint, sjw) : BitTiming();
+}
+
+/// @brief Try the bit lengths from n down to BIT_TQ_MIN time quanta
+static constexpr BitTiming searchBitTiming(uint32_t oscillator, uint32_t bitrate, uint16_t samplePoint, uint8_t sjw, uint8_t n, const BitTiming &best) {
+    return n < BIT_TQ_MIN ? best :
+        searchBitTiming(oscillator, bitrate, samplePoint, sjw, n - 1, betterTiming(best,
+            candidateTiming(oscillator, samplePoint, sjw, n, (oscillator + n * bitrate) / (2UL * n * bitrate)),
+            bitrate, samplePoint));
+}
+
+/// @brief Returns PS2 of CNF register values in time quanta
+/// Without BTLMODE, PS2 is the larger of PS1 and the information processing time of 2 time quanta.
+static constexpr uint8_t phaseSeg2Length(uint8_t cnf2, uint8_t cnf3) {
+    return (cnf2 & 0x80) ? (cnf3 & 0x07) + 1 : maxOf(((cnf2 >> 3) & 0x07) + 1, BIT_PS2_MIN);
+}
+
+/// @brief Returns the bit time of CNF register values in nanoseconds
+/// At most 64 * 25 TQ of 2 periods, 2000000 * 1600 still fits 32 bit with the oscillator in kHz.
+static constexpr uint32_t bitTimeNanos(uint32_t oscillator, uint8_t cnf1, uint8_t cnf2, uint8_t cnf3) {
+    return 2000000UL * ((cnf1 & 0x3F) + 1) *
+        (1 + ((cnf2 & 0x07) + 1) + (((cnf2 >> 3) & 0x07) + 1) + phaseSeg2Length(cnf2, cnf3)) / (oscillator / 1000);
+}
+
+/// @brief Returns a timing given by template arguments
+/// Unlike a constexpr call in run time code, template arguments are always computed by the compiler.
+template<uint8_t Cnf1, uint8_t Cnf2, uint8_t Cnf3, uint32_t Bitrate, uint16_t SamplePoint>
+constexpr BitTiming timingConstant() {
+    return BitTiming(Cnf1, Cnf2, Cnf3, Bitrate, SamplePoint);
+}
+
+} // namespace internal
+
+/// @brief Compute the bit timing for a bitrate
+/// Tries every bit length of 5 to 25 time quanta and keeps the one closest to the requested bitrate,
+/// then to the requested sample point. Can be evaluated at compile time, see bitTiming().
+/// @param oscillator The oscillator frequency of the MCP2515 in Hz
+/// @param bitrate The CAN bitrate in bit/s
+/// @param samplePoint The sample point in 1/1000 of the bit time, 875 (87.5%) is recommended by CiA
+/// @param sjw The synchronization jump width in time quanta (1..4)
+/// @return The register values, invalid if the bitrate can not be reached within 0.5%
+constexpr BitTiming calcBitTiming(uint32_t oscillator, uint32_t bitrate, uint16_t samplePoint = 875, uint8_t sjw = 1) {
+    return (!bitrate || samplePoint >= 1000 || sjw < 1 || sjw > internal::BIT_SJW_MAX) ? BitTiming() :
+        internal::searchBitTiming(oscillator, bitrate, samplePoint, sjw, internal::BIT_TQ_MAX, BitTiming());
+}
+
+/// @brief Compute the bit timing at compile time, an impossible combination does not compile
+/// @code
+/// MCP.setBitrate(bitTiming<16000000, 83333>());
+/// @endcode
+/// @tparam Oscillator The oscillator frequency of the MCP2515 in Hz
+/// @tparam Bitrate The CAN bitrate in bit/s
+/// @tparam SamplePoint The sample point in 1/1000 of the bit time
+/// @tparam Sjw The synchronization jump width in time quanta (1..4)
+/// @return The register values
+template<uint32_t Oscillator, uint32_t Bitrate, uint16_t SamplePoint = 875, uint8_t Sjw = 1>
+constexpr BitTiming bitTiming() {
+    static_assert(Sjw >= 1 && Sjw <= internal::BIT_SJW_MAX, "SJW must be 1 to 4 time quanta");
+    static_assert(SamplePoint > 0 && SamplePoint < 1000, "the sample point is given in 1/1000 of the bit time");
+    static_assert(calcBitTiming(Oscillator, Bitrate, SamplePoint, Sjw).valid(),
+        "the bitrate can not be reached with this oscillator (5 to 25 time quanta of 2 to 128 oscillator periods)");
+    return calcBitTiming(Oscillator, Bitrate, SamplePoint, Sjw);
+}
+
+namespace internal {
+
+/// @brief Like bitTiming(), but an impossible combination gives an invalid timing instead of an error
+/// The solver always runs at compile time, no code of it is left in the program.
+template<uint32_t Oscillator, uint32_t Bitrate>
+constexpr BitTiming fixedTiming() {
+    return timingConstant<calcBitTiming(Oscillator, Bitrate).cnf1, calcBitTiming(Oscillator, Bitrate).cnf2,
+        calcBitTiming(Oscillator, Bitrate).cnf3, calcBitTiming(Oscillator, Bitrate).bitrate,
+        calcBitTiming(Oscillator, Bitrate).samplePoint>();
+}
+
+} // namespace internal
@@ -18,7 +18,7 @@
 
 /// @brief Class representing a CAN packet
 class CANPacket {
-    friend class MCP2515;
+    friend class MCP2515Driver;
 
 public:
     /// @brief Default constructor
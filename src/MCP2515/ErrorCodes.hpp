@@ -20,6 +20,7 @@ public:
         FAILINIT,   ///< Failed to initialize MCP2515
         FAILTX,     ///< Failed to transmit message
         NOMSG,      ///< No messages available
+        PENDING,    ///< Operation is still running
     };
 
     /// @brief Default constructor
@@ -66,7 +67,7 @@ public:
     const char *c_str() const {
         static constexpr const char *messages[] = {
             "OK", "FAIL", "ALLTXBUSY", "FAILINIT", "FAILTX",
-            "NOMSG"
+            "NOMSG", "PENDING"
         };
         Code c = _code;
         if(_code >= sizeof(messages) / sizeof(messages[0]))
@@ -83,7 +84,8 @@ public:
         static const char s3[] PROGMEM = "FAILINIT";
         static const char s4[] PROGMEM = "FAILTX";
         static const char s5[] PROGMEM = "NOMSG";
-        static const char* const messages[] PROGMEM = {s0, s1, s2, s3, s4, s5};
+        static const char s6[] PROGMEM = "PENDING";
+        static const char* const messages[] PROGMEM = {s0, s1, s2, s3, s4, s5, s6};
  
         Code c = _code;
         if(_code >= sizeof(messages) / sizeof(messages[0]))
@@ -0,0 +1,324 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The planner needs relaxed constexpr functions (C++14). With C++11 it runs at run time, which costs
+// O(N^3) steps with 64 bit arithmetic: compute the plan on the host instead and copy the values.
+#ifndef MCP2515_CONSTEXPR14
+# if __cplusplus >= 201402L
+#  define MCP2515_CONSTEXPR14 constexpr
+# else
+#  define MCP2515_CONSTEXPR14
+# endif
+#endif
+
+/// @brief Expected frame rate of a CAN id on the bus, used to weight the filter planning
+struct CanTraffic {
+    uint32_t id;
+    uint32_t rate;      ///< frames per time unit, any unit as long as all entries use the same
+};
+
+namespace internal {
+template<size_t N> class FilterPlanner;
+}
+
+/// @brief Mask and filter values for the acceptance filters of the MCP2515
+/// MASK0 is used by RXF0 and RXF1 (RXB0), MASK1 by RXF2..RXF5 (RXB1).
+struct FilterPlan {
+    template<size_t N> friend class internal::FilterPlanner;
+
+    bool extended{false};
+    uint32_t masks[2]{};
+    uint32_t filters[6]{};
+
+    /// Accepted traffic: the number of accepted CAN ids, or the accepted frame rate if the plan was weighted
+    uint64_t acceptedWeight{0};
+
+    /// The part of acceptedWeight that was not asked for
+    uint64_t falseWeight{0};
+
+    /// @brief Check if the plan can be applied
+    /// A plan is invalid if a wanted id does not fit the id width, i.e. an extended id in a standard id set.
+    /// Check it with static_assert() when the plan is computed at compile time.
+    constexpr bool valid() const { return _valid; }
+
+    /// @brief Check if the acceptance filters let a CAN id pass
+    /// @param id The CAN id
+    /// @return true if the id is accepted by any of the filters
+    constexpr bool accepts(uint32_t id) const {
+        return acceptedBy(id, 0);
+    }
+
+    /// @brief Part of the accepted traffic that was not asked for
+    /// @return A value between 0 (exact) and 1
+    constexpr float falseAcceptRatio() const {
+        return acceptedWeight ? static_cast<float>(falseWeight) / acceptedWeight : 0.0f;
+    }
+
+private:
+    constexpr bool acceptedBy(uint32_t id, uint8_t f) const {
+        return f < 6 && (((id ^ filters[f]) & masks[f < 2 ? 0 : 1]) == 0 || acceptedBy(id, f + 1));
+    }
+
+    bool _valid{false};
+};
+
+namespace internal {
+
+/// @brief Working state of planFilters()
+/// Each cluster of CAN ids is described by a reference id and the mask of the bits all its ids share.
+/// Ids are merged greedily into at most 6 clusters, choosing the merge that adds the least accepted
+/// traffic. For every clustering from 6 down to 1 clusters all splits onto the two masks are evaluated
+/// and the best plan is kept.
+template<size_t N>
+class FilterPlanner {
+public:
+    constexpr FilterPlanner(const uint32_t *ids, bool extended, const CanTraffic *traffic, size_t nTraffic) :
+        _ids(ids), _extended(extended), _traffic(traffic), _nTraffic(nTraffic),
+        _full(extended ? 0x1FFFFFFFUL : 0x7FFUL) { }
+
+    MCP2515_CONSTEXPR14 FilterPlan plan() {
+        // the ids would be cut to the id width, mixed standard and extended ids can't share the filters
+        for(size_t i = 0; i < N; i++) {
+            if(_ids[i] & ~_full)
+                return FilterPlan{};
+        }
+
+        for(size_t i = 0; i < N; i++) {
+            _ref[i] = _ids[i] & _full;
+            _mask[i] = _full;
+            _active[i] = true;
+        }
+
+        size_t clusters = N;
+        FilterPlan best{};
+        bool found = false;
+        while(true) {
+            if(clusters <= 6) {
+                FilterPlan candidate = bestSplit(clusters);
+                if(!found || candidate.acceptedWeight < best.acceptedWeight) {
+                    best = candidate;
+                    found = true;
+                }
+            }
+            if(clusters == 1)
+                break;
+            mergeCheapest();
+            clusters--;
+        }
+        return best;
+    }
+
+private:
+    static MCP2515_CONSTEXPR14 uint8_t popcount(uint32_t v) {
+        uint8_t n = 0;
+        for(; v; v &= v - 1)
+            n++;
+        return n;
+    }
+
+    /// @brief Traffic accepted by a single mask/filter pair
+    MCP2515_CONSTEXPR14 uint64_t cubeWeight(uint32_t mask, uint32_t ref) const {
+        if(!_traffic)
+            return 1ULL << popcount(_full & ~mask);
+
+        uint64_t weight = 0;
+        for(size_t t = 0; t < _nTraffic; t++) {
+            if(((_traffic[t].id ^ ref) & mask) == 0)
+                weight += _traffic[t].rate;
+        }
+        return weight;
+    }
+
+    MCP2515_CONSTEXPR14 void mergeCheapest() {
+        size_t bestA = 0, bestB = 0;
+        int64_t bestCost = 0;
+        bool found = false;
+        for(size_t a = 0; a < N; a++) {
+            if(!_active[a])
+                continue;
+            for(size_t b = a + 1; b < N; b++) {
+                if(!_active[b])
+                    continue;
+                uint32_t mask = _mask[a] & _mask[b] & ~(_ref[a] ^ _ref[b]);
+                int64_t cost = static_cast<int64_t>(cubeWeight(mask, _ref[a]))
+                    - static_cast<int64_t>(cubeWeight(_mask[a], _ref[a]))
+                    - static_cast<int64_t>(cubeWeight(_mask[b], _ref[b]));
+                if(!found || cost < bestCost) {
+                    bestA = a;
+                    bestB = b;
+                    bestCost = cost;
+                    found = true;
+                }
+            }
+        }
+        _mask[bestA] &= _mask[bestB] & ~(_ref[bestA] ^ _ref[bestB]);
+        _active[bestB] = false;
+    }
+
+    MCP2515_CONSTEXPR14 FilterPlan bestSplit(size_t clusters) const {
+        size_t members[6]{};
+        for(size_t i = 0, k = 0; i < N; i++) {
+            if(_active[i])
+                members[k++] = i;
+        }
+
+        // bit c of group0 puts cluster c onto MASK0 (two filters), the others go onto MASK1 (four filters)
+        FilterPlan best{};
+        bool found = false;
+        for(uint8_t group0 = 0; group0 < (1 << clusters); group0++) {
+            uint8_t n0 = popcount(group0);
+            if(n0 > 2 || clusters - n0 > 4)
+                continue;
+
+            FilterPlan candidate = build(members, clusters, group0);
+            if(!found || candidate.acceptedWeight < best.acceptedWeight) {
+                best = candidate;
+                found = true;
+            }
+        }
+        return best;
+    }
+
+    MCP2515_CONSTEXPR14 FilterPlan build(const size_t members[], size_t clusters, uint8_t group0) const {
+        FilterPlan plan{};
+        plan.extended = _extended;
+        plan._valid = true;
+
+        uint32_t masks[2] = {_full, _full};
+        uint8_t count[2] = {0, 0};
+        for(size_t c = 0; c < clusters; c++) {
+            uint8_t g = (group0 & (1 << c)) ? 0 : 1;
+            masks[g] &= _mask[members[c]];
+            count[g]++;
+        }
+        // an unused buffer repeats the other one, so that it accepts nothing extra
+        if(!count[0])
+            masks[0] = masks[1];
+        if(!count[1])
+            masks[1] = masks[0];
+        plan.masks[0] = masks[0];
+        plan.masks[1] = masks[1];
+
+        uint8_t next[2] = {0, 2};
+        for(size_t c = 0; c < clusters; c++) {
+            uint8_t g = (group0 & (1 << c)) ? 0 : 1;
+            plan.filters[next[g]++] = _ref[members[c]] & masks[g];
+        }
+        // unused filters repeat one of the used ones
+        for(uint8_t f = 0; f < 6; f++) {
+            uint8_t g = f < 2 ? 0 : 1;
+            if(f >= next[g])
+                plan.filters[f] = count[g] ? plan.filters[g ? 2 : 0] : plan.filters[g ? 0 : 2] & masks[g];
+        }
+
+        evaluate(plan);
+        return plan;
+    }
+
+    MCP2515_CONSTEXPR14 void evaluate(FilterPlan &plan) const {
+        if(_traffic) {
+            for(size_t t = 0; t < _nTraffic; t++) {
+                if(!plan.accepts(_traffic[t].id))
+                    continue;
+                plan.acceptedWeight += _traffic[t].rate;
+                if(!wanted(_traffic[t].id))
+                    plan.falseWeight += _traffic[t].rate;
+            }
+            return;
+        }
+
+        // size of the union of the six accepted id sets by inclusion-exclusion,
+        // the intersection of two mask/filter pairs is again a mask/filter pair (or empty)
+        int64_t total = 0;
+        for(uint8_t set = 1; set < 64; set++) {
+            uint32_t mask = 0;
+            uint32_t ref = 0;
+            bool empty = false;
+            for(uint8_t f = 0; f < 6 && !empty; f++) {
+                if(!(set & (1 << f)))
+                    continue;
+                uint32_t m = plan.masks[f < 2 ? 0 : 1];
+                if((ref ^ plan.filters[f]) & mask & m)
+                    empty = true;
+                ref = (ref & mask) | (plan.filters[f] & m);
+                mask |= m;
+            }
+            if(empty)
+                continue;
+            int64_t size = 1LL << popcount(_full & ~mask);
+            total += (popcount(set) & 1) ? size : -size;
+        }
+        plan.acceptedWeight = total;
+        plan.falseWeight = total - distinctIds();
+    }
+
+    MCP2515_CONSTEXPR14 bool wanted(uint32_t id) const {
+        for(size_t i = 0; i < N; i++) {
+            if((_ids[i] & _full) == id)
+                return true;
+        }
+        return false;
+    }
+
+    MCP2515_CONSTEXPR14 uint64_t distinctIds() const {
+        uint64_t n = 0;
+        for(size_t i = 0; i < N; i++) {
+            bool duplicate = false;
+            for(size_t j = 0; j < i && !duplicate; j++)
+                duplicate = ((_ids[i] ^ _ids[j]) & _full) == 0;
+            n += duplicate ? 0 : 1;
+        }
+        return n;
+    }
+
+    const uint32_t *_ids;
+    bool _extended;
+    const CanTraffic *_traffic;
+    size_t _nTraffic;
+    uint32_t _full;
+
+    uint32_t _ref[N]{};
+    uint32_t _mask[N]{};
+    bool _active[N]{};
+};
+
+} // namespace internal
+
+/// @brief Compute mask and filter values for a set of wanted CAN ids
+/// Minimizes the number of falsely accepted CAN ids. Meant to be evaluated at compile time, which needs C++14:
+/// @code
+/// constexpr uint32_t wanted[] = {0x100, 0x101, 0x200};
+/// constexpr FilterPlan plan = planFilters(wanted, false);
+/// static_assert(plan.valid(), "wanted ids are not all standard ids");
+/// @endcode
+/// With C++11, i.e. on the AVR core, run it on the host and copy the masks and filters into the sketch.
+/// @param ids The wanted CAN ids, all standard or all extended
+/// @param extended True if the ids are extended CAN ids
+/// @return The mask and filter values, apply them with MCP2515::applyFilterPlan(). Invalid if an id does not
+///         fit the id width.
+template<size_t N>
+MCP2515_CONSTEXPR14 FilterPlan planFilters(const uint32_t (&ids)[N], bool extended) {
+    static_assert(N > 0, "at least one CAN id is needed");
+    return internal::FilterPlanner<N>(ids, extended, nullptr, 0).plan();
+}
+
+/// @brief Compute mask and filter values for a set of wanted CAN ids, weighted by the bus traffic
+/// Minimizes the rate of falsely accepted frames. CAN ids missing in the traffic table are treated as silent.
+/// @param ids The wanted CAN ids, all standard or all extended
+/// @param extended True if the ids are extended CAN ids
+/// @param traffic The expected frame rate per CAN id on the bus
+/// @return The mask and filter values, apply them with MCP2515::applyFilterPlan(). Invalid if an id does not
+///         fit the id width.
+template<size_t N, size_t T>
+MCP2515_CONSTEXPR14 FilterPlan planFilters(const uint32_t (&ids)[N], bool extended, const CanTraffic (&traffic)[T]) {
+    static_assert(N > 0, "at least one CAN id is needed");
+    return internal::FilterPlanner<N>(ids, extended, traffic, T).plan();
+}
@@ -0,0 +1,145 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include "MCP2515.h"
+
+/// @brief Routes received messages to handlers by the acceptance filter which matched them
+/// Every filter RXF0..RXF5 has a handler and optionally a flat table of handlers indexed by
+/// id - base, so a message is routed with two array lookups instead of a search over its id.
+/// Messages without a handler go to the default handler. The invocation count is kept per
+/// handler, the execution time as well if MCP2515_ENABLE_DISPATCH_TIMING is defined.
+class FrameDispatcher {
+public:
+    typedef void (*Handler)(const MCP2515CanPaket &packet);
+
+    /// @brief Invocation count and execution time of a handler
+    /// The times stay 0 unless MCP2515_ENABLE_DISPATCH_TIMING is defined.
+    struct Stats {
+        uint32_t calls{0};
+        uint32_t totalMicros{0};
+        uint32_t maxMicros{0};
+    };
+
+    /// @brief A handler with its statistics
+    struct Route {
+        Handler handler{nullptr};
+        Stats stats;
+    };
+
+    static constexpr uint8_t nFilters = 6;
+
+    /// @brief Set the handler of all messages accepted by a filter
+    /// @param filter The filter index (0..5, see MCP2515::RXF)
+    /// @param handler The handler, nullptr removes it
+    void onFilter(uint8_t filter, Handler handler) {
+        if(filter < nFilters)
+            setRoute(_filters[filter], handler);
+    }
+
+    /// @brief Route the messages of a filter by id, ids outside of the table go to the filter handler
+    /// The table is not copied, it has to stay valid as long as it is set.
+    /// @param filter The filter index (0..5, see MCP2515::RXF)
+    /// @param base The id of the first table entry
+    /// @param table One route per id, entries without handler go to the filter handler
+    /// @param length The number of elements of table, 0 removes the table
+    void setIdTable(uint8_t filter, uint32_t base, Route table[], uint16_t length) {
+        if(filter < nFilters) {
+            _tables[filter].routes = table;
+            _tables[filter].base = base;
+            _tables[filter].length = length;
+        }
+    }
+
+    /// @brief Set the handler of messages without a filter or id handler
+    /// @param handler The handler, nullptr removes it
+    void onDefault(Handler handler) {
+        setRoute(_default, handler);
+    }
+
+    /// @brief Pass a message to its handler
+    /// @param packet The received message
+    /// @return false if no handler took the message
+    bool dispatch(const MCP2515CanPaket &packet) {
+        Route *route = find(packet);
+        if(!route)
+            return false;
+
+#ifdef MCP2515_ENABLE_DISPATCH_TIMING
+        uint32_t start = micros();
+        route->handler(packet);
+        uint32_t elapsed = micros() - start;
+        route->stats.totalMicros += elapsed;
+        if(elapsed > route->stats.maxMicros)
+            route->stats.maxMicros = elapsed;
+#else
+        route->handler(packet);
+#endif
+        route->stats.calls++;
+        return true;
+    }
+
+    /// @brief Returns the statistics of a filter handler
+    /// @param filter The filter index (0..5)
+    const Stats &filterStats(uint8_t filter) const { return _filters[filter < nFilters ? filter : 0].stats; }
+
+    /// @brief Returns the statistics of the default handler
+    const Stats &defaultStats() const { return _default.stats; }
+
+    /// @brief Returns the number of messages MCP2515Driver::processRxQueue() dropped
+    /// These are the messages which neither a handler nor the onReceivePacket() callback took.
+    uint32_t unhandled() const { return _unhandled; }
+
+    /// @brief Clear the statistics of all handlers, including the id tables
+    void resetStats() {
+        for(uint8_t f = 0; f < nFilters; f++) {
+            _filters[f].stats = Stats{};
+            for(uint16_t i = 0; i < _tables[f].length; i++)
+                _tables[f].routes[i].stats = Stats{};
+        }
+        _default.stats = Stats{};
+        _unhandled = 0;
+    }
+
+private:
+    // members are assigned one by one, brace initialization of structs with member initializers needs C++14
+    static void setRoute(Route &route, Handler handler) {
+        route.handler = handler;
+        route.stats = Stats{};
+    }
+
+    struct IdTable {
+        Route *routes{nullptr};
+        uint32_t base{0};
+        uint16_t length{0};
+    };
+
+    Route *find(const MCP2515CanPaket &packet) {
+        const uint8_t filter = packet.getFilterHif();
+        if(filter < nFilters) {
+            const IdTable &table = _tables[filter];
+            // ids below base wrap around to large offsets
+            const uint32_t offset = packet.id() - table.base;
+            if(offset < table.length && table.routes[offset].handler)
+                return &table.routes[offset];
+            if(_filters[filter].handler)
+                return &_filters[filter];
+        }
+        if(_default.handler)
+            return &_default;
+        return nullptr;
+    }
+
+    friend class MCP2515Driver;
+
+    void drop() { _unhandled++; }
+
+    Route _filters[nFilters];
+    IdTable _tables[nFilters];
+    Route _default;
+    uint32_t _unhandled{0};
+};
@@ -0,0 +1,49 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stdint.h>
+
+/// @brief Counts values in bins of powers of two
+/// Bin 0 counts the value 0, bin n the values from 2^(n-1) up to 2^n - 1, the last bin all larger values.
+/// @tparam N The number of bins
+template<uint8_t N = 16>
+class Log2Histogram {
+    static_assert(N > 1 && N <= 33, "Log2Histogram needs 2 to 33 bins");
+
+public:
+    static constexpr uint8_t nBins = N;
+
+    /// @brief Returns the bin of a value
+    static uint8_t bin(uint32_t value) {
+        uint8_t n = 0;
+        while(value && n < N - 1) {
+            value >>= 1;
+            n++;
+        }
+        return n;
+    }
+
+    /// @brief Returns the smallest value of a bin
+    static uint32_t lowerBound(uint8_t bin) { return bin ? 1UL << (bin - 1) : 0; }
+
+    /// @brief Count a value
+    void add(uint32_t value) { _bins[bin(value)]++; }
+
+    /// @brief Returns the number of values in a bin
+    /// @param bin The bin (0..nBins-1)
+    uint32_t operator[](uint8_t bin) const { return bin < N ? _bins[bin] : 0; }
+
+    /// @brief Drop all counts
+    void clear() {
+        for(uint8_t i = 0; i < N; i++)
+            _bins[i] = 0;
+    }
+
+private:
+    uint32_t _bins[N]{};
+};
@@ -7,9 +7,21 @@
 
 #include "MCP2515.h"
 #include "CANPacket.hpp"
+#include "FrameDispatcher.hpp"
 
 using namespace internal; 
 
+#ifdef MCP2515_ENABLE_STATISTICS
+namespace {
+
+inline void updatePeak(uint8_t &peak, uint8_t depth) {
+    if(depth > peak)
+        peak = depth;
+}
+
+} // namespace
+#endif
+
 #define FLAG_RXnIE(n) (0x01 << n)
 #define FLAG_RXnIF(n) (0x01 << n)
 #define FLAG_TXnIF(n) (0x04 << n)
@@ -19,34 +31,34 @@ using namespace internal;
 #define REG_RXFnEID8(n) ((n) < 3 ? (0x02 + (n) * 4) : (0x12 + ((n) - 3) * 4))
 #define REG_RXFnEID0(n) ((n) < 3 ? (0x03 + (n) * 4) : (0x13 + ((n) - 3) * 4))
 
-#define REG_RXMnSIDH(n) (0x20 + (n * 0x04))
-#define REG_RXMnSIDL(n) (0x21 + (n * 0x04))
-#define REG_RXMnEID8(n) (0x22 + (n * 0x04))
-#define REG_RXMnEID0(n) (0x23 + (n * 0x04))
+#define REG_RXMnSIDH(n) (0x20 + ((n) * 0x04))
+#define REG_RXMnSIDL(n) (0x21 + ((n) * 0x04))
+#define REG_RXMnEID8(n) (0x22 + ((n) * 0x04))
+#define REG_RXMnEID0(n) (0x23 + ((n) * 0x04))
 
 #define REG_TXB_COUNT 3
-#define REG_TXBnCTRL(n) (0x30 + (n * 0x10))
+#define REG_TXBnCTRL(n) (0x30 + ((n) * 0x10))
 #define FLAG_TXREQ  0x08
 #define FLAG_TXERR  0x10
 #define FLAG_TXMLOA 0x20
 #define FLAG_TXABTF 0x40
 
-#define REG_TXBnSIDH(n) (0x31 + (n * 0x10))
-#define REG_TXBnSIDL(n) (0x32 + (n * 0x10))
-#define REG_TXBnEID8(n) (0x33 + (n * 0x10))
-#define REG_TXBnEID0(n) (0x34 + (n * 0x10))
-#define REG_TXBnDLC(n) (0x35 + (n * 0x10))
+#define REG_TXBnSIDH(n) (0x31 + ((n) * 0x10))
+#define REG_TXBnSIDL(n) (0x32 + ((n) * 0x10))
+#define REG_TXBnEID8(n) (0x33 + ((n) * 0x10))
+#define REG_TXBnEID0(n) (0x34 + ((n) * 0x10))
+#define REG_TXBnDLC(n) (0x35 + ((n) * 0x10))
 #define FLAG_RTR 0x40
 
-#define REG_TXBnD0(n) (0x36 + (n * 0x10))
+#define REG_TXBnD0(n) (0x36 + ((n) * 0x10))
 
-#define REG_RXBnCTRL(n) (0x60 + (n * 0x10))
-#define REG_RXBnSIDH(n) (0x61 + (n * 0x10))
-#define REG_RXBnSIDL(n) (0x62 + (n * 0x10))
-#define REG_RXBnEID8(n) (0x63 + (n * 0x10))
-#define REG_RXBnEID0(n) (0x64 + (n * 0x10))
-#define REG_RXBnDLC(n) (0x65 + (n * 0x10))
-#define REG_RXBnD0(n) (0x66 + (n * 0x10))
+#define REG_RXBnCTRL(n) (0x60 + ((n) * 0x10))
+#define REG_RXBnSIDH(n) (0x61 + ((n) * 0x10))
+#define REG_RXBnSIDL(n) (0x62 + ((n) * 0x10))
+#define REG_RXBnEID8(n) (0x63 + ((n) * 0x10))
+#define REG_RXBnEID0(n) (0x64 + ((n) * 0x10))
+#define REG_RXBnDLC(n) (0x65 + ((n) * 0x10))
+#define REG_RXBnD0(n) (0x66 + ((n) * 0x10))
 
 #define FLAG_IDE 0x08
 #define FLAG_SRR 0x10
@@ -65,42 +77,185 @@ using namespace internal;
 #define FLAG_ST_TX2REQ  0x40
 #define FLAG_ST_TX2IF   0x80
 
-MCP2515::MCP2515(int cs, CanClock clk, SPIClass &spi) :
-    _csPin(cs),
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+MCP2515Driver *MCP2515Driver::_isrInstance = nullptr;
+#endif
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+MCP2515Driver *MCP2515Driver::_sofInstance = nullptr;
+#endif
+
+MCP2515Driver::MCP2515Driver(MCP2515Transport &transport, CanClock clk) :
     _clockFrequency(clk),
-    _spi(spi)
+    _transport(&transport)
 {
 }
 
-MCP2515Error MCP2515::begin(CanSpeed baudRate) {
-    pinMode(_csPin, OUTPUT);
-    _spi.begin();
-    
-    if(reset())
+void MCP2515Driver::setPins(int cs, int irq) {
+    if(_spiTransport)
+        _spiTransport->setPin(cs);
+    _intPin = irq;
+}
+
+void MCP2515Driver::setPollingPins(int irq, int rx0bf, int rx1bf) {
+    _intPolling = (irq >= 0);
+    if(_intPolling) {
+        _intPin = irq;
+        pinMode(_intPin, INPUT);
+    }
+
+    _rxbfPin[RXB0] = rx0bf;
+    _rxbfPin[RXB1] = rx1bf;
+    for(int8_t pin : _rxbfPin) {
+        if(pin >= 0)
+            pinMode(pin, INPUT);
+    }
+}
+
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+void MCP2515Driver::setSofPin(int pin) {
+    if(_sofPin >= 0) {
+        detachInterrupt(digitalPinToInterrupt(_sofPin));
+        _sofInstance = nullptr;
+    }
+    _sofPin = pin;
+    _sofCount = 0;
+    if(pin < 0)
+        return;
+
+    // the shortest frame, a standard frame without data, takes 44 bits from SOF to EOF
+    uint8_t cnf[3];
+    readRegisters(MCP_CNF3, cnf, sizeof(cnf));
+    _sofMinMicros = 44 * internal::bitTimeNanos(oscillatorFrequency(_clockFrequency), cnf[2], cnf[1], cnf[0]) / 1000;
+
+    _sofInstance = this;
+    pinMode(pin, INPUT);
+    attachInterrupt(digitalPinToInterrupt(pin), sofIsr, RISING);
+}
+
+void MCP2515Driver::sofIsr() {
+    MCP2515Driver *self = _sofInstance;
+    if(!self)
+        return;
+    self->_sofMicros[1] = self->_sofMicros[0];
+    self->_sofMicros[0] = micros();
+    // 0 and 1 are only used until two SOFs were seen
+    self->_sofCount = (self->_sofCount == 0xFF) ? 2 : self->_sofCount + 1;
+}
+
+uint32_t MCP2515Driver::rxTimestamp(uint32_t capture) const {
+    if(_sofPin < 0)
+        return capture;
+
+    // the SOF handler may run in between, read again until the timestamps are consistent
+    uint8_t count;
+    uint32_t sof[2];
+    do {
+        count = _sofCount;
+        sof[0] = _sofMicros[0];
+        sof[1] = _sofMicros[1];
+    } while(count != _sofCount);
+
+    // a frame ends at least the shortest frame time after its SOF, a more recent SOF belongs to the next frame
+    for(uint8_t i = 0; i < count && i < 2; i++) {
+        if(capture - sof[i] >= _sofMinMicros)
+            return sof[i];
+    }
+    return capture;
+}
+#endif
+
+MCP2515Error MCP2515Driver::begin(CanSpeed baudRate) {
+    return begin(speedTiming(baudRate));
+}
+
+MCP2515Error MCP2515Driver::begin(const BitTiming &timing) {
+    if(!timing)
         return MCP2515Error::FAILINIT;
-    if(setBitrate(baudRate)) 
+    return begin(timing.cnf1, timing.cnf2, timing.cnf3);
+}
+
+MCP2515Error MCP2515Driver::begin(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3) {
+    MCP2515Error err = beginAsync(cnf1, cnf2, cnf3);
+    while(err == MCP2515Error::PENDING)
+        err = poll();
+    return err;
+}
+
+MCP2515Error MCP2515Driver::beginAsync(CanSpeed baudRate) {
+    return beginAsync(speedTiming(baudRate));
+}
+
+MCP2515Error MCP2515Driver::beginAsync(const BitTiming &timing) {
+    if(!timing)
         return MCP2515Error::FAILINIT;
-    return setNormalMode();
+    return beginAsync(timing.cnf1, timing.cnf2, timing.cnf3);
 }
 
-MCP2515Error MCP2515::begin(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3) {
-    auto err = begin(CAN_1000KBPS);
-    if(err)
-        return err;
-    
-    setBitrate(cnf1, cnf2, cnf3);
-    return setNormalMode();
+MCP2515Error MCP2515Driver::beginAsync(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3) {
+#ifdef MCP2515_ENABLE_STATISTICS
+    resetStatistics();
+#endif
+    _transport->begin();
+    resetChip();
+
+    // CNF3, CNF2 and CNF1 are consecutive registers
+    _initCnf[0] = cnf3;
+    _initCnf[1] = cnf2;
+    _initCnf[2] = cnf1;
+    _initState = INIT_RESET;
+    _initStart = millis();
+    return MCP2515Error::PENDING;
 }
 
-void MCP2515::end() {
+MCP2515Error MCP2515Driver::poll() {
+    switch(_initState) {
+        case INIT_RESET: {
+            if(!resetDone()) {
+                if(static_cast<uint32_t>(millis()) - _initStart < RESET_TIMEOUT_MS)
+                    return MCP2515Error::PENDING;
+                _initState = INIT_FAILED;
+                return MCP2515Error::FAILINIT;
+            }
+
+            // a single configuration session: bit timing, filters and interrupts in one burst
+            RegisterBatch batch;
+            stageDefaults(batch);
+            batch.write(MCP_CNF3, _initCnf, sizeof(_initCnf));
+            writeBatch(batch, true);
+
+            requestMode(MCP_NORMAL);
+            _initState = INIT_MODE;
+        }
+        // fall through
+        case INIT_MODE: {
+            MCP2515Error err = modeReached();
+            if(err == MCP2515Error::PENDING)
+                return err;
+            _initState = err ? INIT_FAILED : INIT_DONE;
+            return err ? MCP2515Error::FAILINIT : MCP2515Error::OK;
+        }
+        case INIT_DONE:
+            return MCP2515Error::OK;
+        default:
+            return MCP2515Error::FAILINIT;
+    }
+}
+
+void MCP2515Driver::end() {
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    disableInterrupts();
+#endif
     reset();
     setSleepMode();
 }
 
-MCP2515::ErrorFlags MCP2515::getErrorFlags() {
+MCP2515Driver::ErrorFlags MCP2515Driver::getErrorFlags() {
     uint16_t flags = readRegister(MCP_EFLG);
-    
-    uint8_t canIntF = readRegister(MCP_CANINTF);
+    uint8_t intf = readRegister(MCP_CANINTF);
+    countErrors(flags, intf);
+
+    // in interrupt mode the handler moves the error flags out of CANINTF
+    uint8_t canIntF = intf | _pendingErrorFlags;
     flags |= (canIntF & CANINTF_MERRF) ? ErrorFlags::MCP_EFLG_MERR : 0x00;
     flags |= (canIntF & CANINTF_ERRIF) ? ErrorFlags::MCP_EFLG_ERR : 0x00;
 
@@ -110,365 +265,1612 @@ MCP2515::ErrorFlags MCP2515::getErrorFlags() {
     return ErrorFlags{flags, tec, rec};
 }
 
-uint8_t MCP2515::getTxErrorCount() {
+uint8_t MCP2515Driver::getTxErrorCount() {
     return readRegister(MCP_TEC);
 }
 
-uint8_t MCP2515::getRxErrorCount() {
+uint8_t MCP2515Driver::getRxErrorCount() {
     return readRegister(MCP_REC);
 }
 
-void MCP2515::clearErrorFlags() {
+void MCP2515Driver::clearErrorFlags() {
     modifyRegister(MCP_EFLG, EFLG_RX1OVR | EFLG_RX0OVR, 0x00);
     modifyRegister(MCP_CANINTF, CANINTF_MERRF | CANINTF_ERRIF, 0x00);
+    _pendingErrorFlags = 0;
+#ifdef MCP2515_ENABLE_STATISTICS
+    _statsEflg = 0;
+    _statsIntf = 0;
+#endif
 }
 
-void MCP2515::setSPIFrequency(uint32_t frequency) {
-    _spiSettings = SPISettings(frequency, MSBFIRST, SPI_MODE0);
+#ifdef MCP2515_ENABLE_STATISTICS
+MCP2515Driver::Statistics MCP2515Driver::getStatistics() {
+    // the interrupt handler updates the counters
+    noInterrupts();
+    Statistics stats = _stats;
+    interrupts();
+    return stats;
 }
 
-MCP2515Error MCP2515::setMask(const MASK num, bool extended, uint32_t mask) {
-    auto err = setConfigMode();
-    if(err)
-        return err;
+void MCP2515Driver::resetStatistics() {
+    noInterrupts();
+    _stats = Statistics{};
+    interrupts();
+}
+#endif
+
+void MCP2515Driver::stampCapture(uint8_t rxStatus) {
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    // polled messages are timestamped by the first poll which finds them, a message left in its
+    // buffer, i.e. RXB1 after readMessage() took RXB0, keeps that time until it is read
+    const uint8_t found = ((rxStatus & RXSTATUS_RXB0) ? (1 << RXB0) : 0) | ((rxStatus & RXSTATUS_RXB1) ? (1 << RXB1) : 0);
+    if(!(found & ~_rxCaptured))
+        return;
+    const uint32_t now = micros();
+    for(uint8_t n = 0; n < nRxBuffers; n++) {
+        if(found & ~_rxCaptured & (1 << n))
+            _rxCapture[n] = now;
+    }
+    _rxCaptured |= found;
+#else
+    (void)rxStatus;
+#endif
+}
 
-    uint8_t eid0 = 0;
-    uint8_t eid8 = 0;
-    uint8_t sidh;
-    uint8_t sidl;
+void MCP2515Driver::stampDequeue(MCP2515CanPaket packets[], size_t n) {
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    if(!n)
+        return;
+    const uint32_t now = micros();
+    for(size_t i = 0; i < n; i++)
+        packets[i]._dequeueMicros = now;
+#else
+    (void)packets;
+    (void)n;
+#endif
+}
 
-    if (extended) {
-        uint16_t canfilter = mask & 0x0FFFF;
-        eid0 = canfilter & 0xFF;
-        eid8 = canfilter >> 8;
+void MCP2515Driver::countErrors(uint8_t eflg, uint8_t intf) {
+#ifdef MCP2515_ENABLE_STATISTICS
+    // the flags stay set until they are cleared, count them when they appear
+    eflg &= (EFLG_RX0OVR | EFLG_RX1OVR);
+    uint8_t raised = eflg & ~_statsEflg;
+    _statsEflg = eflg;
+    if(raised & EFLG_RX0OVR)
+        _stats.rxOverflows[RXB0]++;
+    if(raised & EFLG_RX1OVR)
+        _stats.rxOverflows[RXB1]++;
+
+    intf &= (CANINTF_ERRIF | CANINTF_MERRF);
+    raised = intf & ~_statsIntf;
+    _statsIntf = intf;
+    if(raised & CANINTF_ERRIF)
+        _stats.errors++;
+    if(raised & CANINTF_MERRF)
+        _stats.messageErrors++;
+#else
+    (void)eflg;
+    (void)intf;
+#endif
+}
 
-        uint16_t canid = mask >> 16;
-        sidh = canid >> 5;
-        sidl = ((canid & 0x03) + ((canid & 0x1C) << 3)) | FLAG_EXIDE;
-    } else {
-        uint16_t canfilter = mask & 0x0FFFF;
-        sidh = canfilter >> 3;
-        sidl = (canfilter & 0x07) << 5;
-    }
+void MCP2515Driver::setSPIFrequency(uint32_t frequency) {
+    if(_spiTransport)
+        _spiTransport->setFrequency(frequency);
+}
 
-    setRegister(REG_RXMnEID0(num), eid0);
-    setRegister(REG_RXMnEID8(num), eid8);
-    setRegister(REG_RXMnSIDH(num), sidh);
-    setRegister(REG_RXMnSIDL(num), sidl);
+MCP2515Error MCP2515Driver::setMask(const MASK num, bool extended, uint32_t mask) {
+    FilterConfig config;
+    config.setMask(num, extended, mask);
+    return applyFilterConfig(config);
+}
 
-    return setNormalMode();
+MCP2515Error MCP2515Driver::setFilter(const RXF num, bool extended, uint32_t filter) {
+    FilterConfig config;
+    config.setFilter(num, extended, filter);
+    return applyFilterConfig(config);
 }
 
-MCP2515Error MCP2515::setFilter(const RXF num, bool extended, uint32_t filter) {
-    auto err = setConfigMode();
-    if(err)
-        return err;
+void MCP2515Driver::FilterConfig::setMask(const MASK num, bool extended, uint32_t mask) {
+    encodeId(mask, extended, _regs[6 + num]);
+    _dirty |= (1 << (6 + num));
+}
 
-    uint8_t eid0 = 0;
-    uint8_t eid8 = 0;
-    uint8_t sidh;
-    uint8_t sidl;
+void MCP2515Driver::FilterConfig::setFilter(const RXF num, bool extended, uint32_t filter) {
+    encodeId(filter, extended, _regs[num]);
+    _dirty |= (1 << num);
+}
 
-    if (extended) {
-        uint16_t canfilter = filter & 0x0FFFF;
-        eid0 = canfilter & 0xFF;
-        eid8 = canfilter >> 8;
+void MCP2515Driver::FilterConfig::stage(RegisterBatch &batch) const {
+    for(uint8_t entry = 0; entry < nEntries; entry++) {
+        if(_dirty & (1 << entry))
+            batch.write(entry < 6 ? REG_RXFnSIDH(entry) : REG_RXMnSIDH(entry - 6), _regs[entry], 4);
+    }
+}
 
-        uint16_t canid = filter >> 16;
-        sidh = canid >> 5;
-        sidl = ((canid & 0x03) + ((canid & 0x1C) << 3)) | FLAG_EXIDE;
-    } else {
-        uint16_t canfilter = filter & 0x0FFFF;
-        sidh = canfilter >> 3;
-        sidl = (canfilter & 0x07) << 5;
+MCP2515Error MCP2515Driver::applyFilterConfig(const FilterConfig &config) {
+    RegisterBatch batch;
+    config.stage(batch);
+    if(!batchChanges(batch))
+        return MCP2515Error::OK;
+
+    // masks and filters can only be written in configuration mode
+    CanModes mode = getMode();
+    if(mode != MCP_CONFIG) {
+        auto err = setConfigMode();
+        if(err)
+            return err;
     }
 
-    setRegister(REG_RXFnEID0(num), eid0);
-    setRegister(REG_RXFnEID8(num), eid8);
-    setRegister(REG_RXFnSIDH(num), sidh);
-    setRegister(REG_RXFnSIDL(num), sidl);
+    writeBatch(batch, true);
+
+    if(mode != MCP_CONFIG)
+        return setMode(static_cast<CanctrlReqopMode>(mode));
+    return MCP2515Error::OK;
+}
+
+MCP2515Error MCP2515Driver::applyFilterPlan(const FilterPlan &plan) {
+    if(!plan.valid())
+        return MCP2515Error::FAIL;
 
-    return setNormalMode();
+    FilterConfig config;
+    config.setMask(MASK0, plan.extended, plan.masks[0]);
+    config.setMask(MASK1, plan.extended, plan.masks[1]);
+    const RXF filters[] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
+    for(uint8_t i = 0; i < sizeof(filters); i++)
+        config.setFilter(filters[i], plan.extended, plan.filters[i]);
+    return applyFilterConfig(config);
 }
 
-MCP2515::CanModes MCP2515::getMode() {
+MCP2515Driver::CanModes MCP2515Driver::getMode() {
+    // not cached, the controller changes the mode on its own, i.e. on wake-up or after a reset
     return static_cast<CanModes>(readRegister(MCP_CANSTAT) & CANSTAT_OPMOD);
 }
 
-MCP2515Error MCP2515::setConfigMode() {
+MCP2515Error MCP2515Driver::setConfigMode() {
     return setMode(CanctrlReqopMode::CANCTRL_REQOP_CONFIG);
 }
 
-MCP2515Error MCP2515::setListenMode() {
+MCP2515Error MCP2515Driver::setListenMode() {
     return setMode(CanctrlReqopMode::CANCTRL_REQOP_LISTENONLY);
 }
 
-MCP2515Error MCP2515::setLoopbackMode() {
+MCP2515Error MCP2515Driver::setLoopbackMode() {
     return setMode(CanctrlReqopMode::CANCTRL_REQOP_LOOPBACK);
 }
 
-MCP2515Error MCP2515::setSleepMode() {
+MCP2515Error MCP2515Driver::setSleepMode() {
     return setMode(CanctrlReqopMode::CANCTRL_REQOP_SLEEP);
 }
 
-MCP2515Error MCP2515::setNormalMode() {
+MCP2515Error MCP2515Driver::setNormalMode() {
     return setMode(CanctrlReqopMode::CANCTRL_REQOP_NORMAL);
 }
 
-MCP2515Error MCP2515::setMode(const CanctrlReqopMode mode) {
-    modifyRegister(MCP_CANCTRL, CANCTRL_REQOP, mode);
+MCP2515Error MCP2515Driver::setMode(const CanctrlReqopMode mode) {
+    MCP2515Error err = requestMode(static_cast<CanModes>(mode));
+    while(err == MCP2515Error::PENDING)
+        err = modeReached();
+    return err;
+}
 
-    uint32_t timeout = millis() + 10;
-    while(millis() < timeout) {
-        if( (readRegister(MCP_CANSTAT) & CANSTAT_OPMOD) == mode) 
-            return MCP2515Error::OK;
+MCP2515Error MCP2515Driver::requestMode(CanModes mode) {
+    const CanctrlReqopMode reqop = static_cast<CanctrlReqopMode>(mode);
+    _modeRequest = reqop;
+    if(getMode() == mode) {
+        _modeResult = MCP2515Error::OK;
+        return _modeResult;
     }
-    return MCP2515Error::FAIL;
+    modifyRegister(MCP_CANCTRL, CANCTRL_REQOP, reqop);
+
+    _modeResult = MCP2515Error::PENDING;
+    _modeRequestedAt = millis();
+    // the first check reads CANSTAT right away
+    _modeLastPoll = micros() - _modePollInterval;
+    return _modeResult;
 }
 
-void MCP2515::setWakeupFilter(bool enable) {
+MCP2515Error MCP2515Driver::modeReached() {
+    if(_modeResult != MCP2515Error::PENDING)
+        return _modeResult;
+
+    // 32 bit differences keep working when millis() and micros() wrap around
+    const bool expired = (static_cast<uint32_t>(millis()) - _modeRequestedAt >= MODE_TIMEOUT_MS);
+    if(!expired && _modePollInterval) {
+        uint32_t now = micros();
+        if(now - _modeLastPoll < _modePollInterval)
+            return MCP2515Error::PENDING;
+        _modeLastPoll = now;
+    }
+
+    if((readRegister(MCP_CANSTAT) & CANSTAT_OPMOD) == _modeRequest) {
+        _modeResult = MCP2515Error::OK;
+    } else if(expired) {
+        _modeResult = MCP2515Error::FAIL;
+    }
+    return _modeResult;
+}
+
+void MCP2515Driver::setModePollInterval(uint16_t us) {
+    _modePollInterval = us;
+}
+
+void MCP2515Driver::setWakeupFilter(bool enable) {
     uint8_t envalue = (enable ? CNF3_WAKFIL : 0x00);
-    modifyRegister(MCP_CNF3, CNF3_WAKFIL, envalue);
+    modifyConfigRegister(MCP_CNF3, CNF3_WAKFIL, envalue);
 }
 
-void MCP2515::setOneShotMode(bool enable) {
+void MCP2515Driver::setOneShotMode(bool enable) {
+    _oneShot = enable;
     uint8_t envalue = (enable ? CANCTRL_OSM : 0x00);
     modifyRegister(MCP_CANCTRL, CANCTRL_OSM, envalue);
 }
 
-void MCP2515::setClockOut(const CanClkOut divisor) {
+void MCP2515Driver::setClockOut(const CanClkOut divisor) {
     if(divisor == CLKOUT_DISABLE) {
-        // disable CLKEN
+        // CNF3.SOF has no effect while CLKEN is cleared
         modifyRegister(MCP_CANCTRL, CANCTRL_CLKEN, 0x00);
-
-        // enable SOF for CLKOUT pin
-        modifyRegister(MCP_CNF3, CNF3_SOF, CNF3_SOF);
+        return;
     }
 
-    // set prescaler
-    modifyRegister(MCP_CANCTRL, CANCTRL_CLKPRE, divisor);
+    if(divisor == CLKOUT_SOF) {
+        // the start-of-frame signal needs CLKEN as well, the prescaler does not apply
+        modifyRegister(MCP_CANCTRL, CANCTRL_CLKEN, CANCTRL_CLKEN);
+        modifyConfigRegister(MCP_CNF3, CNF3_SOF, CNF3_SOF);
+        return;
+    }
 
-    // enable clock out
-    modifyRegister(MCP_CANCTRL, CANCTRL_CLKEN, CANCTRL_CLKEN);
+    // prescaler and enable in a single BIT MODIFY
+    modifyRegister(MCP_CANCTRL, CANCTRL_CLKEN | CANCTRL_CLKPRE, CANCTRL_CLKEN | divisor);
 
-    // disable SOF for clockout pin
-    modifyRegister(MCP_CNF3, CNF3_SOF, 0x00);
+    // clock instead of the start-of-frame signal on the CLKOUT pin
+    modifyConfigRegister(MCP_CNF3, CNF3_SOF, 0x00);
 }
 
-void MCP2515::setRxBufferRollover(bool enable) {
+void MCP2515Driver::setRxBufferRollover(bool enable) {
     modifyRegister(MCP_RXB0CTRL, RXB_0_CTRL_BUKT, (enable) ? 0xFF : 0x00);
 }
 
-MCP2515Error MCP2515::readMessage(RXBn rxbn, MCP2515CanPaket &packet) {
+MCP2515Error MCP2515Driver::readMessage(RXBn rxbn, uint8_t rxStatus, MCP2515CanPaket &packet) {
     const struct RxBnRegs *rxb = &RXB[rxbn];
 
-    packet._rxBuffer = rxbn;
-
-    uint8_t tbufdata[5];
-    readRegisters(rxb->SIDH, tbufdata, sizeof(tbufdata));
+    // buffer, filter and frame type are known before the message is read
+    rxStatus = bufferStatus(rxbn, rxStatus);
+    const bool rtr = (rxStatus & RXSTATUS_RTR);
 
-    uint32_t id = (tbufdata[MCP_SIDH] << 3) + (tbufdata[MCP_SIDL] >> 5);
-    if(tbufdata[MCP_SIDL] & TXB_EXIDE_MASK) {
-        id = (id << 2) + (tbufdata[MCP_SIDL] & 0x03);
-        id = (id << 8) + tbufdata[MCP_EID8];
-        id = (id << 8) + tbufdata[MCP_EID0];
-        packet._extended = true;
+    // READ RX BUFFER starts at RXBnSIDH and clears RXnIF when CS is released,
+    // so header, data and the flag are handled in a single transaction
+    uint8_t buf[1 + 5];
+    buf[0] = rxb->READ;
+    spiEnable();
+    spiTransfer(buf, sizeof(buf));
+    const uint8_t *tbufdata = &buf[1];
+
+    bool extended;
+    uint32_t id = decodeId(tbufdata, extended);
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.rxFrames[rxbn]++;
+#endif
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    // the buffer is released with this transaction, its next message gets a new timestamp
+    const uint32_t rxMicros = _rxCapture[rxbn];
+    _rxCaptured &= ~(1 << rxbn);
+#endif
+
+    // releasing CS frees the rx buffer, the data of a rejected message is never read
+    if(_softwareFilter && !_softwareFilter->accepts(id, extended)) {
+        spiDisable();
+        return MCP2515Error::NOMSG;
     }
-    packet._id = id;
 
-    packet._dlc = (tbufdata[MCP_DLC] & DLC_MASK);
-    if(packet._dlc > CANPacket::MAX_DATA_LENGTH)
+    uint8_t dlc = (tbufdata[MCP_DLC] & DLC_MASK);
+    if(dlc > CANPacket::MAX_DATA_LENGTH) {
+        spiDisable();
         return MCP2515Error::FAIL;
-    
-    uint8_t ctrl = readRegister(rxb->CTRL);
-    if(rxbn == RXB0) {
-        packet._filHit = (ctrl & RXB_0_CTRL_FILHIT);
-    } else {
-        packet._filHit = (ctrl & RXB_1_CTRL_FILHIT);
     }
-    packet._rtr = (ctrl & RXB_CTRL_RTR);
 
-    readRegisters(rxb->DATA, packet._data.data(), packet._dlc);
+    // a remote frame carries no data, only the requested length
+    if(!rtr)
+        spiTransfer(packet._data.data(), dlc);
+    spiDisable();
 
-    modifyRegister(MCP_CANINTF, rxb->CANINTF_RXnIF, 0);
+    packet._id = id;
+    packet._extended = extended;
+    packet._dlc = dlc;
+    packet._rtr = rtr;
+    packet._rxBuffer = rxbn;
+    packet._filHit = filterHit(rxStatus);
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    packet._rxMicros = rxMicros;
+#endif
 
     return MCP2515Error::OK;
 }
 
-bool MCP2515::checkMessage() {
-    return getStatus() & STAT_RXIF_MASK;
+bool MCP2515Driver::checkMessage() {
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    if(_interruptMode)
+        return !_rxQueue.empty();
+#endif
+    if(!intAsserted())
+        return false;
+
+    // the RXnBF pins answer without SPI access
+    if(_rxbfPin[RXB0] >= 0 && _rxbfPin[RXB1] >= 0)
+        return digitalRead(_rxbfPin[RXB0]) == LOW || digitalRead(_rxbfPin[RXB1]) == LOW;
+
+    return getRxStatus() & RXSTATUS_RX_MASK;
+}
+
+bool MCP2515Driver::dispatched(const MCP2515CanPaket &packet) {
+    return _dispatcher && _dispatcher->dispatch(packet);
 }
 
-MCP2515Error MCP2515::readMessage(MCP2515CanPaket &packet) {
+MCP2515Error MCP2515Driver::readMessage(MCP2515CanPaket &packet) {
     MCP2515Error rc;
-    uint8_t stat = getStatus();
+    do {
+        rc = receiveMessage(packet);
+    } while(rc == MCP2515Error::OK && dispatched(packet));
+    return rc;
+}
 
-    if(stat & STAT_RX0IF)
-        rc = readMessage(RXB0, packet);
-    else if(stat & STAT_RX1IF)
-        rc = readMessage(RXB1, packet);
-    else
-        rc = MCP2515Error::NOMSG;
+MCP2515Error MCP2515Driver::receiveMessage(MCP2515CanPaket &packet) {
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    if(_interruptMode) {
+        if(!_rxQueue.pop(packet))
+            return MCP2515Error::NOMSG;
+        stampDequeue(&packet, 1);
+        return MCP2515Error::OK;
+    }
+#endif
 
+    uint8_t stat = pollRxStatus();
+    stampCapture(stat);
+
+    MCP2515Error rc = MCP2515Error::NOMSG;
+    if(stat & RXSTATUS_RXB0)
+        rc = readMessage(RXB0, stat, packet);
+    // a message rejected by the software filter makes room for the next one
+    if(rc == MCP2515Error::NOMSG && (stat & RXSTATUS_RXB1))
+        rc = readMessage(RXB1, stat, packet);
+
+    if(rc == MCP2515Error::OK)
+        stampDequeue(&packet, 1);
     return rc;
 }
 
-MCP2515Error MCP2515::sendMessage(TXBn txbn, const CANPacket &packet) {
+size_t MCP2515Driver::readMessages(MCP2515CanPaket packets[], size_t max) {
+    size_t count = 0;
+
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    if(_interruptMode) {
+        while(count < max && _rxQueue.pop(packets[count])) {
+            stampDequeue(&packets[count], 1);
+            if(!dispatched(packets[count]))
+                count++;
+        }
+        return count;
+    }
+#endif
+
+    if(!max)
+        return 0;
+
+    // with rollover RXB0 always holds the older message
+    uint8_t stat = pollRxStatus();
+    stampCapture(stat);
+    // a message taken by the dispatcher leaves its slot to the next one
+    if((stat & RXSTATUS_RXB0) && readMessage(RXB0, stat, packets[count]) == MCP2515Error::OK) {
+        stampDequeue(&packets[count], 1);
+        if(!dispatched(packets[count]))
+            count++;
+    }
+    if((stat & RXSTATUS_RXB1) && count < max && readMessage(RXB1, stat, packets[count]) == MCP2515Error::OK) {
+        stampDequeue(&packets[count], 1);
+        if(!dispatched(packets[count]))
+            count++;
+    }
+    return count;
+}
+
+void MCP2515Driver::loadTxBuffer(TXBn txbn, const TxEntry &entry, uint8_t priority) {
     const struct TxBnRegs *txbuf = &TXB[txbn];
+    const CANPacket &packet = entry.packet;
+
+    // the previous message is done, it was sent unless it was aborted
+    if((_txAbortRequested & (1 << txbn)) || _oneShot) {
+        if(readRegister(txbuf->CTRL) & TXB_ABTF)
+            markAborted(_txSeq[txbn]);
+        _txAbortRequested &= ~(1 << txbn);
+    }
 
     auto data = serialize(packet);
-    setRegisters(txbuf->SIDH, data.data(), 5 + packet._dlc);
-    modifyRegister(txbuf->CTRL, TXB_TXREQ, TXB_TXREQ);
 
+    // the transfer buffer is in use until the previous transfer is done
+    waitTransport();
+    uint8_t n = 0;
+    if(priority == _txPriority[txbn]) {
+        // LOAD TX BUFFER points directly at TXBnSIDH, no address byte needed
+        _txTransfer[n++] = txbuf->LOAD;
+    } else {
+        // TXP lives in TXBnCTRL, right in front of the frame
+        _txTransfer[n++] = INSTRUCTION_WRITE;
+        _txTransfer[n++] = txbuf->CTRL;
+        _txTransfer[n++] = priority;
+        _txPriority[txbn] = priority;
+    }
+    memcpy(&_txTransfer[n], data.data(), 5 + packet._dlc);
+    n += 5 + packet._dlc;
+    // nothing depends on the completion, the next transaction waits for it
+    spiTransferAsync(_txTransfer, n, nullptr);
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.txFrames[txbn]++;
+#endif
+
+    _txKey[txbn] = arbitrationKey(packet);
+    _txSeq[txbn] = entry.seq;
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    // keep a copy, an aborted message goes back into the queue
+    if(_txScheduling == TX_PRIORITY_PREEMPT)
+        _txPending[txbn] = entry;
+#endif
+}
+
+void MCP2515Driver::requestToSend(uint8_t rts) {
+    // RTS sets TXREQ with a single byte instead of a 4 byte bit modify,
+    // the RTS instructions of several buffers can be or-ed together
+    spiEnable();
+    spiTransfer(rts);
+    spiDisable();
+}
+
+uint32_t MCP2515Driver::arbitrationKey(const CANPacket &packet) {
+    // Lower values win the arbitration: the base id is compared first, a standard frame beats
+    // an extended frame with the same base id (SRR/IDE are recessive), then the extended id
+    // bits and finally RTR (a data frame beats a remote frame).
+    uint32_t key;
+    if(packet._extended)
+        key = ((packet._id >> 18) << 20) | (1UL << 19) | ((packet._id & 0x3FFFF) << 1);
+    else
+        key = (packet._id & 0x7FF) << 20;
+    return key | (packet._rtr ? 1 : 0);
+}
+
+int8_t MCP2515Driver::nextTxBuffer(uint8_t status, uint32_t key, uint8_t &priority) {
+    // The MCP2515 sends the pending buffer with the highest TXP first, on equal TXP the
+    // higher buffer number wins. A new message has to rank below every pending message with
+    // the same or a higher CAN priority and above every pending message with a lower one.
+    // In FIFO mode all messages are treated as equal.
+    const int8_t nRanks = 4 * nTxBuffers;
+    int8_t lower = -1;
+    int8_t upper = nRanks;
+    for(uint8_t n = 0; n < nTxBuffers; n++) {
+        if(!(status & (STAT_TXREQ0 << (2 * n))))
+            continue;
+        int8_t rank = _txPriority[n] * nTxBuffers + n;
+        if(_txScheduling == TX_FIFO || _txKey[n] <= key) {
+            if(rank < upper)
+                upper = rank;
+        } else if(rank > lower) {
+            lower = rank;
+        }
+    }
+
+    // Below the pending messages the highest free rank is taken, to leave as much room as
+    // possible for the next message of the same or lower priority. Otherwise the middle
+    // one is taken, to leave room on both sides.
+    uint8_t free = 0;
+    for(int8_t rank = upper - 1; rank > lower; rank--) {
+        if(!(status & (STAT_TXREQ0 << (2 * (rank % nTxBuffers)))))
+            free++;
+    }
+    if(!free) {
+        // With continuous traffic every message ranks below the previous one, the ranks drift down
+        // until a free buffer has no rank left. Move the pending messages up and try again.
+        if(lower < 0 && (status & (STAT_TXREQ0 | STAT_TXREQ1 | STAT_TXREQ2)) != (STAT_TXREQ0 | STAT_TXREQ1 | STAT_TXREQ2) &&
+           raiseTxPriorities(status))
+            return nextTxBuffer(status, key, priority);
+        return -1;
+    }
+
+    uint8_t skip = (lower < 0 && upper < nRanks) ? 0 : (free - 1) / 2;
+    for(int8_t rank = upper - 1; rank > lower; rank--) {
+        uint8_t n = rank % nTxBuffers;
+        if(!(status & (STAT_TXREQ0 << (2 * n))) && !skip--) {
+            priority = rank / nTxBuffers;
+            return n;
+        }
+    }
+    return -1;
+}
+
+bool MCP2515Driver::raiseTxPriorities(uint8_t status) {
+    // Every pending buffer gets the highest rank below the one of the previous buffer. Ranks only
+    // go up and the highest buffer is moved first, so the order of the pending messages never changes,
+    // not even between two writes. TXP of a pending buffer is evaluated at the next arbitration.
+    const int8_t nRanks = 4 * nTxBuffers;
+    int8_t next = nRanks;
+    uint8_t done = 0;
+    bool raised = false;
+    for(;;) {
+        int8_t top = -1;
+        int8_t topRank = -1;
+        for(uint8_t n = 0; n < nTxBuffers; n++) {
+            int8_t rank = _txPriority[n] * nTxBuffers + n;
+            if((status & (STAT_TXREQ0 << (2 * n))) && !(done & (1 << n)) && rank > topRank) {
+                top = n;
+                topRank = rank;
+            }
+        }
+        if(top < 0)
+            return raised;
+
+        done |= (1 << top);
+        next -= 1 + (next - 1 - top) % nTxBuffers;
+        const uint8_t priority = next / nTxBuffers;
+        if(priority != _txPriority[top]) {
+            modifyRegister(TXB[top].CTRL, TXB_TXP, priority);
+            _txPriority[top] = priority;
+            raised = true;
+        }
+    }
+}
+
+MCP2515Error MCP2515Driver::scheduleTx(const CANPacket &packet, uint8_t &status, uint8_t &rts, TxHandle *handle) {
+    uint32_t key = arbitrationKey(packet);
+    uint8_t priority;
+    int8_t n;
+
+    // sequence number 0 marks an invalid handle
+    TxEntry entry{packet, static_cast<uint16_t>(_txNextSeq ? _txNextSeq : 1)};
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    // queued messages go first, unless the new message is more urgent than all of them
+    n = -1;
+    if(_txQueue.empty() || (_txScheduling != TX_FIFO && key < arbitrationKey(_txQueue.front()->packet))) {
+        n = nextTxBuffer(status, key, priority);
+        if(n < 0 && _txScheduling == TX_PRIORITY_PREEMPT && preemptTx(status, key, rts))
+            n = nextTxBuffer(status, key, priority);
+    }
+#else
+    n = nextTxBuffer(status, key, priority);
+#endif
+
+    if(n >= 0) {
+        loadTxBuffer(static_cast<TXBn>(n), entry, priority);
+        rts |= TXB[n].RTS;
+        status |= (STAT_TXREQ0 << (2 * n));
+    }
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    else if(!queueTx(entry, false)) {
+# ifdef MCP2515_ENABLE_STATISTICS
+        _stats.txBusy++;
+# endif
+        return MCP2515Error::ALLTXBUSY;
+    }
+#else
+    else {
+# ifdef MCP2515_ENABLE_STATISTICS
+        _stats.txBusy++;
+# endif
+        return MCP2515Error::ALLTXBUSY;
+    }
+#endif
+
+    // the slot in the abort history is reused
+    _txAborted[(entry.seq >> 3) & 0x07] &= ~(1 << (entry.seq & 0x07));
+    _txNextSeq = entry.seq + 1;
+    if(handle)
+        handle->_seq = entry.seq;
     return MCP2515Error::OK;
 }
 
-MCP2515Error MCP2515::sendMessage(const CANPacket &packet) {
+MCP2515Error MCP2515Driver::sendMessage(const CANPacket &packet) {
+    return sendMessage(packet, nullptr);
+}
+
+MCP2515Error MCP2515Driver::sendMessage(const CANPacket &packet, TxHandle &handle) {
+    handle._seq = 0;
+    return sendMessage(packet, &handle);
+}
+
+MCP2515Error MCP2515Driver::sendMessage(const CANPacket &packet, TxHandle *handle) {
     if (!packet)
         return MCP2515Error::FAILTX;
 
-    MCP2515Error rc;
+    uint8_t rts = 0;
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    // handleInterrupt() drains the queue, keep it out while the tx buffers are assigned
+    deferInterrupt();
+    uint8_t stat = drainTxQueue(getStatus());
+#else
+    uint8_t stat = getStatus();
+#endif
+
+    MCP2515Error rc = scheduleTx(packet, stat, rts, handle);
+    if(rts)
+        requestToSend(rts);
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    armTxInterrupts();
+    resumeInterrupt();
+#endif
+    return rc;
+}
 
+size_t MCP2515Driver::sendMessages(const CANPacket packets[], size_t n) {
+    size_t count = 0;
+    uint8_t rts = 0;
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    deferInterrupt();
+    uint8_t stat = drainTxQueue(getStatus());
+#else
     uint8_t stat = getStatus();
-    if(!(stat & STAT_TXREQ0))
-        rc = sendMessage(TXB0, packet);
-    else if(!(stat & STAT_TXREQ1))
-        rc = sendMessage(TXB1, packet);
-    else if(!(stat & STAT_TXREQ2))
-        rc = sendMessage(TXB2, packet);
-    else
-        rc = MCP2515Error::ALLTXBUSY;
-    
+#endif
+
+    // nextTxBuffer() ranks every message below the pending ones of the same priority,
+    // so that a single RTS for all buffers keeps the order of the batch
+    while(count < n && packets[count] && scheduleTx(packets[count], stat, rts, nullptr) == MCP2515Error::OK)
+        count++;
+    if(rts)
+        requestToSend(rts);
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    armTxInterrupts();
+    resumeInterrupt();
+#endif
+    return count;
+}
+
+void MCP2515Driver::setSoftwareFilter(const SoftwareFilter *filter) {
+    _softwareFilter = filter;
+}
+
+void MCP2515Driver::setTxScheduling(TxScheduling mode) {
+    _txScheduling = mode;
+}
+
+MCP2515Driver::TxStatus MCP2515Driver::getTxStatus(const TxHandle &handle) {
+    const uint16_t seq = handle._seq;
+    if(!seq)
+        return TX_UNKNOWN;
+
+    TxStatus rc = TX_UNKNOWN;
+    deferInterrupt();
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    for(uint8_t i = 0; i < _txQueue.size(); i++) {
+        if(_txQueue[i].seq == seq)
+            rc = TX_QUEUED;
+    }
+#endif
+
+    for(uint8_t n = 0; rc == TX_UNKNOWN && n < nTxBuffers; n++) {
+        if(_txSeq[n] != seq)
+            continue;
+
+        // MLOA, TXERR and ABTF are kept until the buffer is requested again
+        uint8_t ctrl = readRegister(TXB[n].CTRL);
+        if(ctrl & TXB_TXREQ)
+            rc = (ctrl & TXB_MLOA) ? TX_LOST_ARBITRATION : (ctrl & TXB_TXERR) ? TX_ERROR : TX_PENDING;
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+        else if((ctrl & TXB_ABTF) && (_txAborting & (1 << n)))
+            rc = TX_QUEUED;     // preempted, resolveAborts() puts it back into the queue
+#endif
+        else if(ctrl & TXB_ABTF)
+            rc = TX_ABORTED;
+        else
+            rc = TX_SENT;
+    }
+
+    // done and the buffer was reused, only the aborts of the last 64 messages are remembered
+    if(rc == TX_UNKNOWN && static_cast<uint16_t>(_txNextSeq - seq) <= 64 && _txNextSeq != seq)
+        rc = (_txAborted[(seq >> 3) & 0x07] & (1 << (seq & 0x07))) ? TX_ABORTED : TX_SENT;
+    resumeInterrupt();
+
     return rc;
 }
 
-void MCP2515::spiEnable() {
-    _spi.beginTransaction(_spiSettings);
-    digitalWrite(_csPin, LOW);
+MCP2515Driver::TxStatus MCP2515Driver::waitTxStatus(const TxHandle &handle, uint32_t timeout) {
+    uint32_t start = millis();
+    TxStatus rc;
+    while(true) {
+        rc = getTxStatus(handle);
+        if(rc == TX_SENT || rc == TX_ABORTED || rc == TX_UNKNOWN || millis() - start >= timeout)
+            break;
+        // keep the queue moving without interrupts
+        processTxQueue();
+    }
+    return rc;
 }
 
-void MCP2515::spiDisable() {
-    digitalWrite(_csPin, HIGH);
-    _spi.endTransaction();
+MCP2515Error MCP2515Driver::abortMessage(const TxHandle &handle) {
+    const uint16_t seq = handle._seq;
+    if(!seq)
+        return MCP2515Error::FAIL;
+
+    MCP2515Error rc = MCP2515Error::FAIL;
+    deferInterrupt();
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    for(uint8_t i = 0; i < _txQueue.size(); i++) {
+        if(_txQueue[i].seq != seq)
+            continue;
+
+        // close the gap, the queue order is kept
+        for(uint8_t j = i; j > 0; j--)
+            _txQueue[j] = _txQueue[j - 1];
+        _txQueue.pop();
+        markAborted(seq);
+        armTxInterrupts();
+        rc = MCP2515Error::OK;
+        break;
+    }
+#endif
+
+    if(rc) {
+        uint8_t status = getStatus();
+        for(uint8_t n = 0; n < nTxBuffers; n++) {
+            if(_txSeq[n] == seq && (status & (STAT_TXREQ0 << (2 * n)))) {
+                // a message already on the bus is still sent, getTxStatus() tells the outcome
+                modifyRegister(TXB[n].CTRL, TXB_TXREQ, 0x00);
+                _txAbortRequested |= (1 << n);
+                rc = MCP2515Error::OK;
+            }
+        }
+    }
+    resumeInterrupt();
+
+    return rc;
 }
 
-MCP2515Error MCP2515::reset() {
-    spiEnable();
-    _spi.transfer(INSTRUCTION_RESET);
-    spiDisable();
+void MCP2515Driver::abortAllMessages() {
+    deferInterrupt();
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    TxEntry entry;
+    while(_txQueue.pop(entry))
+        markAborted(entry.seq);
+    armTxInterrupts();
+#endif
+
+    // CANCTRL.ABAT would have to be held until all TXREQ bits are clear,
+    // clearing TXREQ of the pending buffers does the same without waiting
+    uint8_t status = getStatus();
+    for(uint8_t n = 0; n < nTxBuffers; n++) {
+        if(status & (STAT_TXREQ0 << (2 * n))) {
+            modifyRegister(TXB[n].CTRL, TXB_TXREQ, 0x00);
+            _txAbortRequested |= (1 << n);
+        }
+    }
+    resumeInterrupt();
+}
 
-    delay(10);
+void MCP2515Driver::markAborted(uint16_t seq) {
+    _txAborted[(seq >> 3) & 0x07] |= (1 << (seq & 0x07));
+}
 
-    // clearing all tx buffers
-    uint8_t zeros[14] = {};
-    setRegisters(MCP_TXB0CTRL, zeros, sizeof(zeros));
-    setRegisters(MCP_TXB1CTRL, zeros, sizeof(zeros));
-    setRegisters(MCP_TXB2CTRL, zeros, sizeof(zeros));
+size_t MCP2515Driver::getTxQueueLength() {
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    return _txQueue.size();
+#else
+    return 0;
+#endif
+}
 
-    setRegister(MCP_RXB0CTRL, 0x00);
-    setRegister(MCP_RXB1CTRL, 0x00);
+void MCP2515Driver::processTxQueue() {
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    deferInterrupt();
+    serviceTx(getStatus());
+    resumeInterrupt();
+#endif
+}
 
-    setRegister(MCP_CANINTE, CANINTF_RX0IF | CANINTF_RX1IF | CANINTF_ERRIF | CANINTF_MERRF);
+void MCP2515Driver::handleInterrupt() {
+    if(_intDeferring) {
+        _intDeferred = true;
+        return;
+    }
+    deferInterrupt();
+    serviceInterrupt();
+    resumeInterrupt();
+}
 
-    modifyRegister(MCP_RXB0CTRL, RXB_CTRL_RXM_MASK, RXB_CTRL_RXM_STDEXT);
-    modifyRegister(MCP_RXB1CTRL, RXB_CTRL_RXM_MASK, RXB_CTRL_RXM_STDEXT);
+void MCP2515Driver::serviceInterrupt() {
+    // INT is only released once all enabled flags are cleared. A flag raised while the
+    // handler is running would not cause a new edge, so keep going until INT is high.
+    while(true) {
+#if defined(MCP2515_ENABLE_RX_TIMESTAMP) && !defined(MCP2515_DISABLE_ASYNC_RX_QUEUE)
+        const uint32_t capture = micros();
+#endif
+        uint8_t status = getStatus();
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+        // the rx buffers overflow fastest, empty them first
+        if(_interruptMode && (status & STAT_RXIF_MASK)) {
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+            // both buffers are emptied right away
+            _rxCapture[RXB0] = _rxCapture[RXB1] = rxTimestamp(capture);
+#endif
+            uint8_t rxStatus = getRxStatus();
+            if(rxStatus & RXSTATUS_RXB0)
+                receiveToQueue(RXB0, rxStatus);
+            if(rxStatus & RXSTATUS_RXB1)
+                receiveToQueue(RXB1, rxStatus);
+        }
+        const bool pinKnown = _interruptMode || _intPolling;
+#else
+        const bool pinKnown = _intPolling;
+#endif
+        serviceTx(status);
+
+        if(pinKnown && digitalRead(_intPin) == HIGH)
+            break;
 
-    // clear all filters
-    const RXF filters[] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
-    for(uint8_t i = 0; i < sizeof(filters); i++) {
-        bool ext = (i == 1);
-        auto rc = setFilter(filters[i], ext, 0);
-        if(rc)
-            return rc;
+        // error and wake-up flags hold INT low as well, keep them for getErrorFlags()
+        uint8_t intf = readRegister(MCP_CANINTF);
+        uint8_t errors = intf & (CANINTF_ERRIF | CANINTF_MERRF | CANINTF_WAKIF);
+        if(errors) {
+#ifdef MCP2515_ENABLE_STATISTICS
+            countErrors((errors & CANINTF_ERRIF) ? readRegister(MCP_EFLG) : _statsEflg, errors);
+            // cleared below, the next event raises them again
+            _statsIntf &= ~errors;
+#endif
+            _pendingErrorFlags |= errors;
+            modifyRegister(MCP_CANINTF, errors, 0x00);
+        }
+
+        // received messages are left to the polling calls, they keep the tx queue moving until
+        // the messages are read, see intAsserted()
+        uint8_t handled = 0;
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+        if(_interruptMode)
+            handled |= CANINTF_RX0IF | CANINTF_RX1IF;
+#endif
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+        if(_txInterrupts)
+            handled |= CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF;
+#endif
+        if(!(intf & handled))
+            break;
+    }
+}
+
+void MCP2515Driver::deferInterrupt() {
+    // the main line is about to run a chain of SPI transactions on the tx state, which the
+    // INT handler changes as well. Only the handler is held back, other interrupts keep running.
+    _intDeferring = true;
+}
+
+void MCP2515Driver::resumeInterrupt() {
+    while(true) {
+        while(_intDeferred) {
+            _intDeferred = false;
+            serviceInterrupt();
+        }
+        _intDeferring = false;
+        // an INT from now on runs the handler itself, one noted right before has to be handled here
+        if(!_intDeferred)
+            return;
+        _intDeferring = true;
+    }
+}
+
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+void MCP2515Driver::enableInterrupts() {
+    if(_interruptMode)
+        return;
+
+    _isrInstance = this;
+    _interruptMode = true;
+
+    pinMode(_intPin, INPUT);
+    // keep the handler out of running SPI transactions
+    _transport->usingInterrupt(digitalPinToInterrupt(_intPin));
+    attachInterrupt(digitalPinToInterrupt(_intPin), isr, FALLING);
+
+    // INT may already be low, in which case there will be no falling edge
+    handleInterrupt();
+}
+
+void MCP2515Driver::disableInterrupts() {
+    if(!_interruptMode)
+        return;
+
+    detachInterrupt(digitalPinToInterrupt(_intPin));
+    _transport->notUsingInterrupt(digitalPinToInterrupt(_intPin));
+    _interruptMode = false;
+    _isrInstance = nullptr;
+}
+
+void MCP2515Driver::onReceivePacket(void (*callback)(const MCP2515CanPaket &packet)) {
+    _onReceive = callback;
+    if(callback)
+        enableInterrupts();
+}
+
+void MCP2515Driver::receiveToQueue(RXBn rxbn, uint8_t rxStatus) {
+    if(_rxQueue.full()) {
+        // drop the message, clearing RXnIF releases the rx buffer without reading it
+        modifyRegister(MCP_CANINTF, RXB[rxbn].CANINTF_RXnIF, 0x00);
+#ifdef MCP2515_ENABLE_STATISTICS
+        _stats.rxFrames[rxbn]++;
+        _stats.rxDropped++;
+#endif
+        return;
+    }
+
+    if(_transport->async()) {
+        receiveAsync(rxbn, rxStatus);
+        return;
+    }
+
+    if(readMessage(rxbn, rxStatus, *_rxQueue.reserve()) == MCP2515Error::OK) {
+        _rxQueue.commit();
+#ifdef MCP2515_ENABLE_STATISTICS
+        updatePeak(_stats.rxQueuePeak, _rxQueue.size());
+#endif
+    }
+}
+
+void MCP2515Driver::receiveAsync(RXBn rxbn, uint8_t rxStatus) {
+    // the previous transfer may still use the buffer
+    rxStatus = bufferStatus(rxbn, rxStatus);
+    waitTransport();
+    _rxTransferStatus = rxStatus;
+    _rxTransferBuffer = rxbn;
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    _rxTransferMicros = _rxCapture[rxbn];
+    _rxCaptured &= ~(1 << rxbn);
+#endif
+
+    // the DLC is not known in advance, the whole buffer is read in one go unless it is a remote frame
+    size_t len = (_rxTransferStatus & RXSTATUS_RTR) ? 1 + 5 : sizeof(_rxTransfer);
+    _rxTransfer[0] = RXB[rxbn].READ;
+    spiTransferAsync(_rxTransfer, len, receiveComplete);
+}
+
+void MCP2515Driver::receiveComplete(void *context) {
+    MCP2515Driver *self = static_cast<MCP2515Driver *>(context);
+    const uint8_t *tbufdata = &self->_rxTransfer[1];
+#ifdef MCP2515_ENABLE_STATISTICS
+    self->_stats.rxFrames[self->_rxTransferBuffer]++;
+#endif
+
+    bool extended;
+    uint32_t id = decodeId(tbufdata, extended);
+    uint8_t dlc = (tbufdata[MCP_DLC] & DLC_MASK);
+    if(dlc > CANPacket::MAX_DATA_LENGTH)
+        return;
+    if(self->_softwareFilter && !self->_softwareFilter->accepts(id, extended))
+        return;
+
+    // dropped if the queue is full, the rx buffer is released anyway
+    MCP2515CanPaket *packet = self->_rxQueue.reserve();
+    if(!packet) {
+#ifdef MCP2515_ENABLE_STATISTICS
+        self->_stats.rxDropped++;
+#endif
+        return;
+    }
+
+    const uint8_t rxStatus = self->_rxTransferStatus;
+    const bool rtr = (rxStatus & RXSTATUS_RTR);
+    if(!rtr)
+        memcpy(packet->_data.data(), &tbufdata[5], dlc);
+    packet->_id = id;
+    packet->_extended = extended;
+    packet->_dlc = dlc;
+    packet->_rtr = rtr;
+    packet->_rxBuffer = self->_rxTransferBuffer;
+    packet->_filHit = filterHit(rxStatus);
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    packet->_rxMicros = self->_rxTransferMicros;
+#endif
+    self->_rxQueue.commit();
+#ifdef MCP2515_ENABLE_STATISTICS
+    updatePeak(self->_stats.rxQueuePeak, self->_rxQueue.size());
+#endif
+}
+
+void MCP2515Driver::isr() {
+    if(_isrInstance)
+        _isrInstance->handleInterrupt();
+}
+#endif
+
+void MCP2515Driver::setDispatcher(FrameDispatcher *dispatcher) {
+    _dispatcher = dispatcher;
+}
+
+void MCP2515Driver::processRxQueue() {
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    if(!_onReceive && !_dispatcher)
+        return;
+#else
+    if(!_dispatcher)
+        return;
+#endif
+
+    // readMessage() passes the messages to the dispatcher already
+    MCP2515CanPaket packet;
+    while(readMessage(packet) == MCP2515Error::OK) {
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+        if(_onReceive) {
+            _onReceive(packet);
+            continue;
+        }
+#endif
+        // no handler and no callback took the message
+        _dispatcher->drop();
+    }
+}
+
+void MCP2515Driver::serviceTx(uint8_t status) {
+    // acknowledge completed transmissions, TXnIF is every other bit of the status byte
+    uint8_t txif = 0;
+    for(uint8_t n = 0; n < nTxBuffers; n++) {
+        if(status & (STAT_TX0IF << (2 * n)))
+            txif |= (CANINTF_TX0IF << n);
+    }
+    if(txif)
+        modifyRegister(MCP_CANINTF, txif, 0x00);
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    drainTxQueue(status);
+    armTxInterrupts();
+#endif
+}
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+uint8_t MCP2515Driver::drainTxQueue(uint8_t status) {
+    if(_txAborting)
+        resolveAborts(status);
+
+    uint8_t rts = 0;
+    uint8_t priority;
+    int8_t n;
+    while(!_txQueue.empty() && (n = nextTxBuffer(status, arbitrationKey(_txQueue.front()->packet), priority)) >= 0) {
+        loadTxBuffer(static_cast<TXBn>(n), *_txQueue.front(), priority);
+        _txQueue.pop();
+        rts |= TXB[n].RTS;
+        status |= (STAT_TXREQ0 << (2 * n));
+    }
+    if(rts)
+        requestToSend(rts);
+    return status;
+}
+
+void MCP2515Driver::armTxInterrupts() {
+    // TXnIF only has to pull INT low while messages wait for a free tx buffer. Otherwise nobody
+    // might clear the flags, i.e. in polled mode, and INT would stay low after the first transmission.
+    const bool arm = !_txQueue.empty();
+    if(arm == _txInterrupts)
+        return;
+    _txInterrupts = arm;
+    modifyRegister(MCP_CANINTE, CANINTF_TX0IF | CANINTF_TX1IF | CANINTF_TX2IF, arm ? 0xFF : 0x00);
+}
+
+bool MCP2515Driver::queueTx(const TxEntry &entry, bool requeue) {
+    if(!_txQueue.push(entry))
+        return false;
+#ifdef MCP2515_ENABLE_STATISTICS
+    updatePeak(_stats.txQueuePeak, _txQueue.size());
+#endif
+    if(_txScheduling == TX_FIFO)
+        return true;
+
+    // keep the queue sorted by priority, messages of the same priority stay in order.
+    // A requeued message was sent before the queued ones and goes in front of them.
+    uint32_t key = arbitrationKey(entry.packet);
+    uint8_t i = _txQueue.size() - 1;
+    while(i > 0) {
+        uint32_t prev = arbitrationKey(_txQueue[i - 1].packet);
+        if(prev < key || (prev == key && !requeue))
+            break;
+        _txQueue[i] = _txQueue[i - 1];
+        i--;
+    }
+    _txQueue[i] = entry;
+    return true;
+}
+
+bool MCP2515Driver::preemptTx(uint8_t &status, uint32_t key, uint8_t &rts) {
+    // the aborted message needs a place in the queue
+    if(_txQueue.full())
+        return false;
+
+    // abort the pending message with the lowest priority, the latest one on equal priority
+    int8_t victim = -1;
+    for(uint8_t n = 0; n < nTxBuffers; n++) {
+        if(!(status & (STAT_TXREQ0 << (2 * n))) || _txKey[n] <= key || (_txAborting & (1 << n)))
+            continue;
+        if(victim < 0 || _txKey[n] > _txKey[victim] ||
+           (_txKey[n] == _txKey[victim] && _txPriority[n] * nTxBuffers + n < _txPriority[victim] * nTxBuffers + victim))
+            victim = n;
+    }
+    if(victim < 0)
+        return false;
+
+    // buffers loaded in the same call have to be started before one of them can be aborted
+    if(rts) {
+        requestToSend(rts);
+        rts = 0;
     }
 
-    // clear all masks
-    const MASK masks[] = {MASK0, MASK1};
-    for(uint8_t i=0;i<sizeof(masks);i++){
-        auto rc = setMask(masks[i], true, 0);
-        if(rc)
-            return rc;
+    modifyRegister(TXB[victim].CTRL, TXB_TXREQ, 0x00);
+    uint8_t ctrl = readRegister(TXB[victim].CTRL);
+    if(ctrl & TXB_TXREQ) {
+        // the message is on the bus right now, resolveAborts() checks the outcome later
+        _txAborting |= (1 << victim);
+        return false;
+    }
+
+    // ABTF is not set if the message made it onto the bus before the abort
+    if(ctrl & TXB_ABTF)
+        queueTx(_txPending[victim], true);
+    status &= ~(STAT_TXREQ0 << (2 * victim));
+    return true;
+}
+
+void MCP2515Driver::resolveAborts(uint8_t status) {
+    for(uint8_t n = 0; n < nTxBuffers; n++) {
+        if(!(_txAborting & (1 << n)) || (status & (STAT_TXREQ0 << (2 * n))))
+            continue;
+
+        // lost if the queue filled up in the meantime
+        if(readRegister(TXB[n].CTRL) & TXB_ABTF)
+            queueTx(_txPending[n], true);
+        _txAborting &= ~(1 << n);
+    }
+}
+#endif
+
+void MCP2515Driver::spiEnable() {
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    const uint32_t start = _spiTrace ? micros() : 0;
+#endif
+    waitTransport();
+    _transport->select();
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.spiTransactions++;
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    // the INT handler is kept out from here on, the record can't be mixed up with one of its transactions
+    if(_spiTrace)
+        _spiTrace->begin(start, micros());
+#endif
+}
+
+void MCP2515Driver::spiDisable() {
+    _transport->deselect();
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    if(_spiTrace)
+        _spiTrace->end(micros());
+#endif
+}
+
+uint8_t MCP2515Driver::spiTransfer(uint8_t data) {
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.spiBytes++;
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    if(_spiTrace)
+        _spiTrace->add(data);
+#endif
+    return _transport->transfer(data);
+}
+
+void MCP2515Driver::spiTransfer(uint8_t buf[], size_t n) {
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.spiBytes += n;
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    if(_spiTrace)
+        _spiTrace->add(buf, n);
+#endif
+    _transport->transfer(buf, n);
+}
+
+void MCP2515Driver::spiWrite(const uint8_t buf[], size_t n) {
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.spiBytes += n;
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    if(_spiTrace)
+        _spiTrace->add(buf, n);
+#endif
+    _transport->write(buf, n);
+}
+
+void MCP2515Driver::spiTransferAsync(uint8_t buf[], size_t n, MCP2515Transport::Callback done) {
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    const uint32_t start = _spiTrace ? micros() : 0;
+#endif
+    waitTransport();
+#ifdef MCP2515_ENABLE_STATISTICS
+    _stats.spiTransactions++;
+    _stats.spiBytes += n;
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    if(_spiTrace) {
+        _spiTrace->begin(start, micros());
+        _spiTrace->add(buf, n);
+    }
+#endif
+    _transport->transferAsync(buf, n, done, this);
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    if(_spiTrace)
+        _spiTrace->end(micros(), _transport->async());
+#endif
+}
+
+void MCP2515Driver::waitTransport() {
+    // also called from the INT handler: busy() completes the transfer by polling,
+    // see MCP2515Transport::busy()
+    while(_transport->busy()) { }
+}
+
+MCP2515Error MCP2515Driver::reset() {
+    resetChip();
+
+    uint32_t start = millis();
+    while(!resetDone()) {
+        if(static_cast<uint32_t>(millis()) - start >= RESET_TIMEOUT_MS)
+            return MCP2515Error::FAIL;
     }
 
+    RegisterBatch batch;
+    stageDefaults(batch);
+    // the chip is in configuration mode after the reset
+    writeBatch(batch, true);
+
     return MCP2515Error::OK;
 }
 
-uint8_t MCP2515::readRegister(const uint8_t address) {
+void MCP2515Driver::resetChip() {
     spiEnable();
-    _spi.transfer(INSTRUCTION_READ);
-    _spi.transfer(address);
-    uint8_t value = _spi.transfer(0x00);
+    spiTransfer(INSTRUCTION_RESET);
     spiDisable();
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    _shadow.reset();
+#endif
+
+    // the reset clears TXBnCTRL, the rest of a tx buffer is written with every message
+    for(auto &prio : _txPriority)
+        prio = 0;
+    for(auto &seq : _txSeq)
+        seq = 0;
+    _txAbortRequested = 0;
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    _txAborting = 0;
+    _txInterrupts = false;
+#endif
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    _rxCaptured = 0;
+#endif
+}
 
-    return value;
+bool MCP2515Driver::resetDone() {
+    // instead of a fixed delay: CANSTAT and CANCTRL read back their reset values once the oscillator is running
+    uint8_t regs[2];
+    readRegisters(MCP_CANSTAT, regs, sizeof(regs));
+    return (regs[0] & CANSTAT_OPMOD) == CANCTRL_REQOP_CONFIG && regs[1] == CANCTRL_RESET;
 }
 
-void MCP2515::readRegisters(const uint8_t address, uint8_t val[], const uint8_t n) {
-    spiEnable();
-    _spi.transfer(INSTRUCTION_READ);
-    _spi.transfer(address);
-    // MCP2515 has auto increment of address pointer
-    for(uint8_t i = 0; i < n; i++) {
-        val[i] = _spi.transfer(0x00);
+void MCP2515Driver::stageDefaults(RegisterBatch &batch) const {
+    batch.write(MCP_RXB0CTRL, 0x00);
+    batch.write(MCP_RXB1CTRL, 0x00);
+    batch.modify(MCP_RXB0CTRL, RXB_CTRL_RXM_MASK, RXB_CTRL_RXM_STDEXT);
+    batch.modify(MCP_RXB1CTRL, RXB_CTRL_RXM_MASK, RXB_CTRL_RXM_STDEXT);
+
+    // the tx interrupts are only enabled while the async tx queue waits for a free buffer, see armTxInterrupts()
+    batch.write(MCP_CANINTE, CANINTF_RX0IF | CANINTF_RX1IF | CANINTF_ERRIF | CANINTF_MERRF);
+
+    // RXnBF pins low while the rx buffer is full, BFPCTRL follows the filters in the same burst
+    uint8_t bfp = 0;
+    if(_rxbfPin[RXB0] >= 0)
+        bfp |= BFPCTRL_B0BFE | BFPCTRL_B0BFM;
+    if(_rxbfPin[RXB1] >= 0)
+        bfp |= BFPCTRL_B1BFE | BFPCTRL_B1BFM;
+    if(bfp)
+        batch.write(MCP_BFPCTRL, bfp);
+
+    // clear all filters and masks
+    FilterConfig config;
+    const RXF filters[] = {RXF0, RXF1, RXF2, RXF3, RXF4, RXF5};
+    for(uint8_t i = 0; i < sizeof(filters); i++) {
+        bool ext = (i == 1);
+        config.setFilter(filters[i], ext, 0);
     }
+    config.setMask(MASK0, true, 0);
+    config.setMask(MASK1, true, 0);
+    config.stage(batch);
+}
+
+uint8_t MCP2515Driver::readRegister(const uint8_t address) {
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    uint8_t cached;
+    if(_shadow.read(address, cached))
+        return cached;
+#endif
+    uint8_t buf[3] = {INSTRUCTION_READ, address, 0x00};
+    spiEnable();
+    spiTransfer(buf, sizeof(buf));
     spiDisable();
+
+    return buf[2];
 }
 
-void MCP2515::setRegister(const uint8_t address, const uint8_t value) {
+void MCP2515Driver::readRegisters(const uint8_t address, uint8_t val[], const uint8_t n) {
+    const uint8_t cmd[2] = {INSTRUCTION_READ, address};
     spiEnable();
-    _spi.transfer(INSTRUCTION_WRITE);
-    _spi.transfer(address);
-    _spi.transfer(value);
+    spiWrite(cmd, sizeof(cmd));
+    // MCP2515 has auto increment of address pointer, the bytes sent while reading are ignored
+    spiTransfer(val, n);
     spiDisable();
 }
 
-void MCP2515::setRegisters(const uint8_t address, const uint8_t val[], const uint8_t n) {
+void MCP2515Driver::setRegister(const uint8_t address, const uint8_t value) {
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    if(!_shadow.changes(address, 0xFF, value))
+        return;
+    _shadow.store(address, value);
+#endif
+    const uint8_t buf[3] = {INSTRUCTION_WRITE, address, value};
     spiEnable();
-    _spi.transfer(INSTRUCTION_WRITE);
-    _spi.transfer(address);
-    // MCP2515 has auto increment of address pointer
+    spiWrite(buf, sizeof(buf));
+    spiDisable();
+}
+
+void MCP2515Driver::setRegisters(const uint8_t address, const uint8_t val[], const uint8_t n) {
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    bool changes = false;
     for(uint8_t i = 0; i < n; i++) {
-        _spi.transfer(val[i]);
+        changes |= _shadow.changes(address + i, 0xFF, val[i]);
+        _shadow.store(address + i, val[i]);
     }
+    if(!changes)
+        return;
+#endif
+    const uint8_t cmd[2] = {INSTRUCTION_WRITE, address};
+    spiEnable();
+    spiWrite(cmd, sizeof(cmd));
+    // MCP2515 has auto increment of address pointer
+    spiWrite(val, n);
+    spiDisable();
+}
+
+void MCP2515Driver::modifyRegister(const uint8_t address, const uint8_t mask, const uint8_t value) {
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    if(!_shadow.changes(address, mask, value))
+        return;
+    _shadow.modify(address, mask, value);
+#endif
+    const uint8_t buf[4] = {INSTRUCTION_BITMOD, address, mask, value};
+    spiEnable();
+    spiWrite(buf, sizeof(buf));
     spiDisable();
 }
 
-void MCP2515::modifyRegister(const uint8_t address, const uint8_t mask, const uint8_t value) {
+bool MCP2515Driver::knownValue(const uint8_t address, uint8_t &value) const {
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    return _shadow.value(address, value);
+#else
+    (void)address;
+    (void)value;
+    return false;
+#endif
+}
+
+bool MCP2515Driver::batchValue(const RegisterBatch::Entry &entry, uint8_t &value) const {
+    if(entry.mask == 0xFF) {
+        value = entry.value;
+        return true;
+    }
+
+    // a partial update becomes a complete write if the rest of the register is known
+    uint8_t known;
+    if(!knownValue(entry.address, known))
+        return false;
+    value = (known & ~entry.mask) | entry.value;
+    return true;
+}
+
+bool MCP2515Driver::batchChanges(const RegisterBatch &batch) const {
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    for(uint8_t i = 0; i < batch.size(); i++) {
+        if(_shadow.changes(batch[i].address, batch[i].mask, batch[i].value))
+            return true;
+    }
+    return false;
+#else
+    return !batch.empty();
+#endif
+}
+
+void MCP2515Driver::writeBatch(const RegisterBatch &batch, bool configMode) {
+    // in configuration mode, a short gap of known registers is cheaper to rewrite than a new transaction
+    const bool bridge = configMode;
+    constexpr uint8_t maxGap = 3;
+
+    uint8_t i = 0;
+    while(i < batch.size()) {
+        const RegisterBatch::Entry &first = batch[i];
+        uint8_t value;
+        if(!batchValue(first, value)) {
+            modifyRegister(first.address, first.mask, first.value);
+            i++;
+            continue;
+        }
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+        if(!_shadow.changes(first.address, 0xFF, value)) {
+            i++;
+            continue;
+        }
+#endif
+
+        // extend the burst up to the last following register which changes
+        uint8_t end = i + 1;
+        for(uint8_t k = i + 1; k < batch.size(); k++) {
+            uint8_t gapStart = batch[k - 1].address + 1;
+            uint8_t gap = batch[k].address - gapStart;
+            bool adjacent = (gap == 0);
+            if(!adjacent && bridge && gap <= maxGap) {
+                adjacent = true;
+                for(uint8_t a = gapStart; a < batch[k].address; a++)
+                    adjacent &= knownValue(a, value);
+            }
+            if(!adjacent || !batchValue(batch[k], value))
+                break;
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+            if(_shadow.changes(batch[k].address, 0xFF, value))
+#endif
+                end = k + 1;
+        }
+
+        // the burst is sent in blocks, bridged registers are rewritten with their known value
+        uint8_t buf[16];
+        uint8_t len = 0;
+        buf[len++] = INSTRUCTION_WRITE;
+        buf[len++] = first.address;
+        spiEnable();
+        for(uint8_t a = first.address, k = i; k < end; a++) {
+            if(a == batch[k].address) {
+                batchValue(batch[k], value);
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+                _shadow.store(a, value);
+#endif
+                k++;
+            } else {
+                knownValue(a, value);
+            }
+            buf[len++] = value;
+            if(len == sizeof(buf)) {
+                spiWrite(buf, len);
+                len = 0;
+            }
+        }
+        spiWrite(buf, len);
+        spiDisable();
+        i = end;
+    }
+}
+
+MCP2515Error MCP2515Driver::modifyConfigRegister(const uint8_t address, const uint8_t mask, const uint8_t value) {
+    // a read is much cheaper than the trip through configuration mode
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    if(!_shadow.changes(address, mask, value))
+        return MCP2515Error::OK;
+#else
+    if(((readRegister(address) ^ value) & mask) == 0)
+        return MCP2515Error::OK;
+#endif
+    // CNF1..CNF3, filters and masks ignore writes outside of configuration mode
+    CanModes mode = getMode();
+    if(mode != MCP_CONFIG) {
+        auto err = setConfigMode();
+        if(err)
+            return err;
+    }
+
+    modifyRegister(address, mask, value);
+
+    if(mode != MCP_CONFIG)
+        return setMode(static_cast<CanctrlReqopMode>(mode));
+    return MCP2515Error::OK;
+}
+
+uint8_t MCP2515Driver::getStatus() {
+    uint8_t buf[2] = {INSTRUCTION_READ_STATUS, 0x00};
     spiEnable();
-    _spi.transfer(INSTRUCTION_BITMOD);
-    _spi.transfer(address);
-    _spi.transfer(mask);
-    _spi.transfer(value);
+    spiTransfer(buf, sizeof(buf));
     spiDisable();
+
+    return buf[1];
 }
 
-uint8_t MCP2515::getStatus() {
+uint8_t MCP2515Driver::getRxStatus() {
+    uint8_t buf[2] = {INSTRUCTION_RX_STATUS, 0x00};
     spiEnable();
-    _spi.transfer(INSTRUCTION_READ_STATUS);
-    uint8_t ret = _spi.transfer(0x00);
+    spiTransfer(buf, sizeof(buf));
     spiDisable();
 
-    return ret;
+    return buf[1];
 }
 
-std::array<uint8_t, 8 + 5> MCP2515::serialize(const CANPacket &packet) {
-    std::array<uint8_t, 8+5> dat;
+bool MCP2515Driver::intAsserted() {
+    // INT is high as long as no enabled interrupt flag is set, this includes RX0IF and RX1IF
+    if(_intPolling && digitalRead(_intPin) == HIGH)
+        return false;
+
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    // while messages wait in the tx queue, completed transmissions hold INT low as well. With INT
+    // already held low by a received message they cause no edge for handleInterrupt() either, so
+    // acknowledge them and refill the tx buffers, then INT tells again if a message is pending
+    if(_txInterrupts) {
+        processTxQueue();
+        return !_intPolling || digitalRead(_intPin) == LOW;
+    }
+#endif
+    return true;
+}
+
+uint8_t MCP2515Driver::pollRxStatus() {
+    if(!intAsserted())
+        return 0;
+
+    // INT is held low by TX and error flags as well, the RXnBF pins only by received messages
+    if(_rxbfPin[RXB0] >= 0 && _rxbfPin[RXB1] >= 0 &&
+       digitalRead(_rxbfPin[RXB0]) == HIGH && digitalRead(_rxbfPin[RXB1]) == HIGH)
+        return 0;
 
-    uint16_t canid = packet._id & 0x0FFFF;
-    if(packet._extended) {
-        dat[MCP_EID0] = canid & 0xFF;
-        dat[MCP_EID8] = canid >> 8;
-        canid = packet._id >> 16;
-        dat[MCP_SIDL] = canid & 0x03;
-        dat[MCP_SIDL] += ((canid & 0x1C) << 3);
-        dat[MCP_SIDL] |= TXB_EXIDE_MASK;
-        dat[MCP_SIDH] = canid >> 5;
+    return getRxStatus();
+}
+
+uint8_t MCP2515Driver::bufferStatus(RXBn rxbn, uint8_t rxStatus) {
+    // with both buffers full, RX STATUS describes RXB0
+    if(rxbn == RXB0 || !(rxStatus & RXSTATUS_RXB0))
+        return rxStatus;
+
+    uint8_t ctrl = readRegister(RXB[RXB1].CTRL);
+    // FILHIT 0 and 1 of RXB1 are RXF0 and RXF1 rolled over
+    uint8_t filHit = ctrl & RXB_1_CTRL_FILHIT;
+    if(filHit <= 1)
+        filHit += RXSTATUS_FILHIT_ROLLOVER;
+    return RXSTATUS_RXB1 | ((ctrl & RXB_CTRL_RTR) ? RXSTATUS_RTR : 0) | filHit;
+}
+
+void MCP2515Driver::encodeId(uint32_t id, bool extended, uint8_t buf[4]) {
+    uint16_t canid = id & 0x0FFFF;
+    if(extended) {
+        buf[MCP_EID0] = canid & 0xFF;
+        buf[MCP_EID8] = canid >> 8;
+        canid = id >> 16;
+        buf[MCP_SIDL] = canid & 0x03;
+        buf[MCP_SIDL] += ((canid & 0x1C) << 3);
+        buf[MCP_SIDL] |= TXB_EXIDE_MASK;
+        buf[MCP_SIDH] = canid >> 5;
     } else {
-        dat[MCP_SIDH] = canid >> 3;
-        dat[MCP_SIDL] = ((canid & 0x07) << 5);
-        dat[MCP_EID0] = 0x00;
-        dat[MCP_EID8] = 0x00;
+        buf[MCP_SIDH] = canid >> 3;
+        buf[MCP_SIDL] = ((canid & 0x07) << 5);
+        buf[MCP_EID0] = 0x00;
+        buf[MCP_EID8] = 0x00;
+    }
+}
+
+uint32_t MCP2515Driver::decodeId(const uint8_t buf[4], bool &extended) {
+    uint32_t id = (buf[MCP_SIDH] << 3) + (buf[MCP_SIDL] >> 5);
+    extended = (buf[MCP_SIDL] & TXB_EXIDE_MASK);
+    if(extended) {
+        id = (id << 2) + (buf[MCP_SIDL] & 0x03);
+        id = (id << 8) + buf[MCP_EID8];
+        id = (id << 8) + buf[MCP_EID0];
     }
+    return id;
+}
+
+std::array<uint8_t, 8 + 5> MCP2515Driver::serialize(const CANPacket &packet) {
+    std::array<uint8_t, 8+5> dat;
+
+    encodeId(packet._id, packet._extended, dat.data());
 
     dat[MCP_DLC] = packet._dlc;
     dat[MCP_DLC] |= (packet._rtr) ? RTR_MASK : 0x00;
@@ -477,213 +1879,62 @@ std::array<uint8_t, 8 + 5> MCP2515::serialize(const CANPacket &packet) {
     return dat;
 }
 
-MCP2515Error MCP2515::setBitrate(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3) {
+MCP2515Error MCP2515Driver::setBitrate(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3) {
     auto err = setConfigMode();
     if(err)
         return err;
 
-    setRegister(MCP_CNF1, cnf1);
-    setRegister(MCP_CNF2, cnf2);
-    setRegister(MCP_CNF3, cnf3);
+    // CNF3, CNF2 and CNF1 are consecutive registers
+    const uint8_t cnf[] = {cnf3, cnf2, cnf1};
+    setRegisters(MCP_CNF3, cnf, sizeof(cnf));
     return MCP2515Error::OK;
 }
 
-MCP2515Error MCP2515::setBitrate(CanSpeed speed) {
-    auto err = setConfigMode();
-    if(err)
-        return err;
+MCP2515Error MCP2515Driver::setBitrate(CanSpeed speed) {
+    return setBitrate(speedTiming(speed));
+}
 
-    mcp_baud_cfg cfg{};
-    switch(_clockFrequency){
-        case CanClock::MCP_8MHZ :
-            switch(speed) {
-                case CAN_1000KBPS:
-                    cfg = MCP_8MHZ_1000KBPS;
-                    break;
-                case CAN_500KBPS:
-                    cfg = MCP_8MHZ_500KBPS;
-                    break;
-                case CAN_250KBPS:
-                    cfg = MCP_8MHZ_250KBPS;
-                    break;
-                case CAN_200KBPS:
-                    cfg = MCP_8MHZ_200KBPS;
-                    break;
-                case CAN_125KBPS:
-                    cfg = MCP_8MHZ_125KBPS;
-                    break;
-                case CAN_100KBPS:
-                    cfg = MCP_8MHZ_100KBPS;
-                    break;
-                case CAN_80KBPS:
-                    cfg = MCP_8MHZ_80KBPS;
-                    break;
-                case CAN_50KBPS:
-                    cfg = MCP_8MHZ_50KBPS;
-                    break;
-                case CAN_40KBPS:
-                    cfg = MCP_8MHZ_40KBPS;
-                    break;
-                case CAN_33KBPS:
-                    cfg = MCP_8MHZ_33K3BPS;
-                    break;
-                case CAN_31K25BPS:
-                    cfg = MCP_8MHZ_31K25BPS;
-                    break;
-                case CAN_20KBPS:
-                    cfg = MCP_8MHZ_20KBPS;
-                    break;
-                case CAN_10KBPS:
-                    cfg = MCP_8MHZ_10KBPS;
-                    break;
-                case CAN_5KBPS:
-                    cfg = MCP_8MHZ_5KBPS;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case CanClock::MCP_12MHZ:
-            switch(speed) {
-                case CAN_1000KBPS:
-                    cfg = MCP_12MHZ_1000KBPS;
-                    break;
-                case CAN_500KBPS:
-                    cfg = MCP_12MHZ_500KBPS;
-                    break;
-                case CAN_250KBPS:
-                    cfg = MCP_12MHZ_250KBPS;
-                    break;
-                case CAN_200KBPS:
-                    cfg = MCP_12MHZ_200KBPS;
-                    break;
-                case CAN_125KBPS:
-                    cfg = MCP_12MHZ_125KBPS;
-                    break;
-                case CAN_100KBPS:
-                    cfg = MCP_12MHZ_100KBPS;
-                    break;
-                case CAN_80KBPS:
-                    cfg = MCP_12MHZ_80KBPS;
-                    break;
-                case CAN_50KBPS:
-                    cfg = MCP_12MHZ_50KBPS;
-                    break;
-                case CAN_40KBPS:
-                    cfg = MCP_12MHZ_40KBPS;
-                    break;
-                case CAN_33KBPS:
-                    cfg = MCP_12MHZ_33K3BPS;
-                    break;
-                case CAN_20KBPS:
-                    cfg = MCP_12MHZ_20KBPS;
-                    break;
-                case CAN_10KBPS:
-                    cfg = MCP_12MHZ_10KBPS;
-                    break;
-                case CAN_5KBPS:
-                    cfg = MCP_12MHZ_5KBPS;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case CanClock::MCP_16MHZ:
-            switch(speed) {
-                case CAN_1000KBPS:
-                    cfg = MCP_16MHZ_1000KBPS;
-                    break;
-                case CAN_500KBPS:
-                    cfg = MCP_16MHZ_500KBPS;
-                    break;
-                case CAN_250KBPS:
-                    cfg = MCP_16MHZ_250KBPS;
-                    break;
-                case CAN_200KBPS:
-                    cfg = MCP_16MHZ_200KBPS;
-                    break;
-                case CAN_125KBPS:
-                    cfg = MCP_16MHZ_125KBPS;
-                    break;
-                case CAN_100KBPS:
-                    cfg = MCP_16MHZ_100KBPS;
-                    break;
-                case CAN_80KBPS:
-                    cfg = MCP_16MHZ_80KBPS;
-                    break;
-                case CAN_83K3BPS:
-                    cfg = MCP_16MHZ_83K3BPS;
-                    break;
-                case CAN_50KBPS:
-                    cfg = MCP_16MHZ_50KBPS;
-                    break;
-                case CAN_40KBPS:
-                    cfg = MCP_16MHZ_40KBPS;
-                    break;
-                case CAN_33KBPS:
-                    cfg = MCP_16MHZ_33K3BPS;
-                    break;
-                case CAN_20KBPS:
-                    cfg = MCP_16MHZ_20KBPS;
-                    break;
-                case CAN_10KBPS:
-                    cfg = MCP_16MHZ_10KBPS;
-                    break;
-                case CAN_5KBPS:
-                    cfg = MCP_16MHZ_5KBPS;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case CanClock::MCP_20MHZ:
-            switch(speed) {
-                case CAN_1000KBPS:
-                    cfg = MCP_20MHZ_1000KBPS;
-                    break;
-                case CAN_500KBPS:
-                    cfg = MCP_20MHZ_500KBPS;
-                    break;
-                case CAN_250KBPS:
-                    cfg = MCP_20MHZ_250KBPS;
-                    break;
-                case CAN_200KBPS:
-                    cfg = MCP_20MHZ_200KBPS;
-                    break;
-                case CAN_125KBPS:
-                    cfg = MCP_20MHZ_125KBPS;
-                    break;
-                case CAN_100KBPS:
-                    cfg = MCP_20MHZ_100KBPS;
-                    break;
-                case CAN_83K3BPS:
-                    cfg = MCP_20MHZ_83K3BPS;
-                    break;
-                case CAN_80KBPS:
-                    cfg = MCP_20MHZ_80KBPS;
-                    break;
-                case CAN_50KBPS:
-                    cfg = MCP_20MHZ_50KBPS;
-                    break;
-                case CAN_40KBPS:
-                    cfg = MCP_20MHZ_40KBPS;
-                    break;
-                case CAN_33KBPS:
-                    cfg = MCP_20MHZ_33K3BPS;
-                    break;
-                default:
-                    break;
-            }
-            break;
-    }
+MCP2515Error MCP2515Driver::setBitrate(const BitTiming &timing) {
+    if(!timing)
+        return MCP2515Error::FAIL;
+    return setBitrate(timing.cnf1, timing.cnf2, timing.cnf3);
+}
 
-    if(cfg) {
-        setRegister(MCP_CNF1, cfg.cnf1);
-        setRegister(MCP_CNF2, cfg.cnf2);
-        setRegister(MCP_CNF3, cfg.cnf3);
+template<uint32_t Oscillator>
+BitTiming MCP2515Driver::speedTiming(CanSpeed speed) {
+    // every timing is solved by the compiler, only the table of register values is left
+    using internal::fixedTiming;
+    switch(speed) {
+        case CAN_1KBPS:     return fixedTiming<Oscillator, 1000UL>();
+        case CAN_5KBPS:     return fixedTiming<Oscillator, 5000UL>();
+        case CAN_10KBPS:    return fixedTiming<Oscillator, 10000UL>();
+        case CAN_12K5BPS:   return fixedTiming<Oscillator, 12500UL>();
+        case CAN_16KBPS:    return fixedTiming<Oscillator, 16000UL>();
+        case CAN_20KBPS:    return fixedTiming<Oscillator, 20000UL>();
+        case CAN_25KBPS:    return fixedTiming<Oscillator, 25000UL>();
+        case CAN_31K25BPS:  return fixedTiming<Oscillator, 31250UL>();
+        case CAN_33KBPS:    return fixedTiming<Oscillator, 33333UL>();
+        case CAN_40KBPS:    return fixedTiming<Oscillator, 40000UL>();
+        case CAN_50KBPS:    return fixedTiming<Oscillator, 50000UL>();
+        case CAN_80KBPS:    return fixedTiming<Oscillator, 80000UL>();
+        case CAN_83K3BPS:   return fixedTiming<Oscillator, 83333UL>();
+        case CAN_95KBPS:    return fixedTiming<Oscillator, 95000UL>();
+        case CAN_100KBPS:   return fixedTiming<Oscillator, 100000UL>();
+        case CAN_125KBPS:   return fixedTiming<Oscillator, 125000UL>();
+        case CAN_200KBPS:   return fixedTiming<Oscillator, 200000UL>();
+        case CAN_250KBPS:   return fixedTiming<Oscillator, 250000UL>();
+        case CAN_500KBPS:   return fixedTiming<Oscillator, 500000UL>();
+        case CAN_800KBPS:   return fixedTiming<Oscillator, 800000UL>();
+        case CAN_1000KBPS:  return fixedTiming<Oscillator, 1000000UL>();
+        default:            return BitTiming();
+    }
+}
 
-        return MCP2515Error::OK;
-    } else {
-        return MCP2515Error::FAIL;
+BitTiming MCP2515Driver::speedTiming(CanSpeed speed) const {
+    switch(_clockFrequency) {
+        case MCP_20MHZ: return speedTiming<20000000UL>(speed);
+        case MCP_16MHZ: return speedTiming<16000000UL>(speed);
+        case MCP_12MHZ: return speedTiming<12000000UL>(speed);
+        default:        return speedTiming<8000000UL>(speed);
     }
 }
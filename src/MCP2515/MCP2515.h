@@ -12,18 +12,43 @@
 #include <Arduino.h>
 #include <SPI.h>
 
+#include "BitTiming.hpp"
 #include "CANPacket.hpp"
 #include "ErrorCodes.hpp"
+#include "FilterPlanner.hpp"
+#include "RegisterBatch.hpp"
+#include "RegisterShadow.hpp"
+#include "RingBuffer.hpp"
+#include "SoftwareFilter.hpp"
+#include "SpiTrace.hpp"
+#include "Transport.hpp"
 #include "mcp2515_def.h"
 
 #define MCP2515_DEFAULT_CS_PIN  10
 #define MCP2515_DEFAULT_INT_PIN 2
 
-class MCP2515;
+#ifndef MCP2515_CANPACKET_TX_QUEUE_SIZE
+# ifdef __AVR__
+#  define MCP2515_CANPACKET_TX_QUEUE_SIZE 8
+# else
+#  define MCP2515_CANPACKET_TX_QUEUE_SIZE 16
+# endif
+#endif
+
+#ifndef MCP2515_CANPACKET_RX_QUEUE_SIZE
+# ifdef __AVR__
+#  define MCP2515_CANPACKET_RX_QUEUE_SIZE 4
+# else
+#  define MCP2515_CANPACKET_RX_QUEUE_SIZE 8
+# endif
+#endif
+
+class MCP2515Driver;
+class FrameDispatcher;
 
 /// @brief MCP2515 specific CAN packet
 class MCP2515CanPaket : public CANPacket {
-    friend class MCP2515;
+    friend class MCP2515Driver;
 public:
     MCP2515CanPaket() = default;
 
@@ -35,16 +60,36 @@ public:
     /// @return The rx buffer used
     const uint8_t &getRxBuffer() const { return _rxBuffer; }
 
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    /// @brief Returns micros() at the reception of the packet
+    /// The start of frame with MCP2515::setSofPin(), else the INT edge in interrupt mode, else the first poll
+    /// which found the packet in polled mode
+    uint32_t getRxTimestamp() const { return _rxMicros; }
+
+    /// @brief Returns micros() when the application took the packet from the driver
+    uint32_t getDequeueTimestamp() const { return _dequeueMicros; }
+
+    /// @brief Returns the microseconds from reception until the application took the packet
+    uint32_t getLatency() const { return _dequeueMicros - _rxMicros; }
+#endif
+
 private:
     int8_t _filHit{-1};
     uint8_t _rxBuffer{0xFF};
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    uint32_t _rxMicros{0};
+    uint32_t _dequeueMicros{0};
+#endif
 };
 
-/// @brief MCP2515 driver class
-class MCP2515 {
+/// @brief MCP2515 driver class, talks to the chip through any MCP2515Transport
+/// MCP2515 adds the default transport over an Arduino SPIClass, MCP2515T a transport fixed at compile time.
+class MCP2515Driver {
 public:
      /// @brief CAN baudrate configration values
-     /// @attention Not all combination of MCP2515 clock & baudrate are supported
+     /// @attention Not all combination of MCP2515 clock & baudrate are possible, see calcBitTiming().
+     /// CAN_1KBPS fails with every clock, CAN_5KBPS with 20 MHz, CAN_800KBPS with 12 and 20 MHz
+     /// and CAN_1000KBPS with 8 MHz.
     enum CanSpeed: uint8_t {
         CAN_1KBPS,
         CAN_5KBPS,
@@ -84,6 +129,41 @@ public:
         CLKOUT_DIV2 = 0x1,
         CLKOUT_DIV4 = 0x2,
         CLKOUT_DIV8 = 0x3,
+        CLKOUT_SOF = 0x4,       ///< Start-of-frame signal instead of the clock
+    };
+
+    /// @brief Order in which the tx buffers and the async tx queue send the messages
+    enum TxScheduling : uint8_t {
+        TX_FIFO,                ///< In the order passed to sendMessage()
+        TX_PRIORITY,            ///< By CAN id priority, messages of equal priority in order (default)
+        TX_PRIORITY_PREEMPT,    ///< Like TX_PRIORITY, but a pending message of lower priority is aborted and requeued
+                                ///< if all tx buffers are busy (needs the async tx queue)
+    };
+
+    /// @brief Transmission status of a message, see getTxStatus()
+    enum TxStatus : uint8_t {
+        TX_UNKNOWN,             ///< Invalid handle, or the message is too old to be tracked
+        TX_QUEUED,              ///< Waiting in the async tx queue
+        TX_PENDING,             ///< Waiting in a tx buffer for transmission
+        TX_LOST_ARBITRATION,    ///< Pending, the last attempt lost the arbitration (TXBnCTRL.MLOA)
+        TX_ERROR,               ///< Pending, the last attempt hit a bus error (TXBnCTRL.TXERR)
+        TX_SENT,                ///< Sent successfully
+        TX_ABORTED,             ///< Aborted, or failed in one-shot mode (TXBnCTRL.ABTF)
+    };
+
+    /// @brief Handle of a sent message, to track its transmission status
+    /// The handle is a sequence number, it stays valid for the next 64 sent messages
+    /// once the message left the tx buffer.
+    class TxHandle {
+        friend class MCP2515Driver;
+    public:
+        TxHandle() = default;
+
+        /// @brief returns true if the handle refers to an accepted message
+        explicit operator bool() const { return _seq; }
+
+    private:
+        uint16_t _seq{0};
     };
 
     /// @brief CAN protocol engine modes
@@ -111,6 +191,41 @@ public:
         RXF5 = 5
     };
 
+    /// @brief Collects mask and filter changes, which are written by applyFilterConfig()
+    /// in a single configuration mode session
+    class FilterConfig {
+        friend class MCP2515Driver;
+    public:
+        FilterConfig() = default;
+
+        /// @brief Set the Mask bits for the sepific rx buffer
+        /// @param num The rx buffer to set
+        /// @param extended True if extended CAN IDs are used
+        /// @param mask The value of the CAN ID mask
+        void setMask(const MASK num, bool extended, uint32_t mask);
+
+        /// @brief Set the CAN ID filter for the specific filter entry
+        /// @param num The filter to set
+        /// @param extended True if extended CAN IDs are used
+        /// @param filter The value of the CAN ID filter
+        void setFilter(const RXF num, bool extended, uint32_t filter);
+
+        /// @brief Drop all collected changes
+        void clear() { _dirty = 0; }
+
+        /// @brief returns true if no change was collected
+        bool empty() const { return !_dirty; }
+
+    private:
+        /// @brief Add the changed registers to a batch
+        void stage(internal::RegisterBatch &batch) const;
+
+        // register image of RXF0..RXF5 and RXM0..RXM1, bit n of _dirty marks entry n as changed
+        static constexpr uint8_t nEntries = 8;
+        uint8_t _regs[nEntries][4];
+        uint8_t _dirty{0};
+    };
+
     /// @brief All error related flags
     /// See http://www.can-wiki.info/doku.php?id=can_faq:can_faq_erors for further 
     /// information about the CAN warning and error states
@@ -208,19 +323,63 @@ public:
         const uint8_t rec;
    };
 
+#ifdef MCP2515_ENABLE_STATISTICS
+    /// @brief Counters of the driver, see getStatistics()
+    struct Statistics {
+        uint32_t rxFrames[2]{};         ///< Messages received in RXB0 and RXB1, including those rejected by the software filter or dropped
+        uint32_t rxDropped{0};          ///< Messages dropped because the rx queue was full
+        uint32_t rxOverflows[2]{};      ///< RX0OVR and RX1OVR events, messages lost in the MCP2515
+        uint32_t txFrames[3]{};         ///< Messages loaded into TXB0..TXB2
+        uint32_t txBusy{0};             ///< Messages rejected with ALLTXBUSY
+        uint32_t errors{0};             ///< ERRIF events
+        uint32_t messageErrors{0};      ///< MERRF events
+        uint32_t spiTransactions{0};
+        uint32_t spiBytes{0};
+        uint8_t txQueuePeak{0};         ///< Most messages waiting in the tx queue at once
+        uint8_t rxQueuePeak{0};         ///< Most messages waiting in the rx queue at once
+    };
+#endif
+
 
 public:
-    /// @brief MCP2515 constructor
-    /// @param cs The SPI chip select pin
+    /// @brief MCP2515 constructor with a custom transport, f.e. a DMA capable SPI peripheral
+    /// @param transport The transport used for communication, must outlive the driver
     /// @param clk The MCP2515 clock frequency (supported frequencies: 8MHz, 12Mhz, 16Mhz, 20Mhz)
-    /// @param spi The SPI object used for communication
-    MCP2515(int cs = MCP2515_DEFAULT_CS_PIN, CanClock clk = CanClock::MCP_8MHZ, SPIClass &spi = SPI);
+    explicit MCP2515Driver(MCP2515Transport &transport, CanClock clk = CanClock::MCP_8MHZ);
+
+    /// @brief Override the default CS and INT pins
+    /// Must be called before begin()
+    /// @param cs The SPI chip select pin, not used with a custom transport
+    /// @param irq The INT pin, must be interrupt capable for interrupt mode
+    void setPins(int cs, int irq = MCP2515_DEFAULT_INT_PIN);
+
+    /// @brief Check the INT pin, and the RX0BF/RX1BF pins if wired, before polling the rx buffers over SPI
+    /// checkMessage(), readMessage() and readMessages() return without SPI access if no message is pending.
+    /// With both RXnBF pins wired, checkMessage() answers from the pins. Must be called before begin()
+    /// @param irq The INT pin, -1 if not connected
+    /// @param rx0bf The RX0BF pin, -1 if not connected
+    /// @param rx1bf The RX1BF pin, -1 if not connected
+    void setPollingPins(int irq, int rx0bf = -1, int rx1bf = -1);
+
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    /// @brief Timestamp received messages with the start-of-frame signal
+    /// The CLKOUT pin has to be set to CLKOUT_SOF with setClockOut() and wired to an interrupt capable pin.
+    /// Only applies to messages received by handleInterrupt(). Call after begin() and after changing the bitrate,
+    /// the shortest frame time tells the start of a received frame from the start of the next one.
+    /// @param pin The pin connected to CLKOUT, -1 to stop
+    void setSofPin(int pin);
+#endif
 
     /// @brief Setup MCP2515 with the selected baud rate
     /// @param baudRate The baudrate to use
     /// @return MCP2515Error::OK if successful
     MCP2515Error begin(CanSpeed baudRate);
 
+    /// @brief Setup MCP2515 with a computed bit timing
+    /// @param timing The bit timing, see calcBitTiming() and bitTiming()
+    /// @return MCP2515Error::OK if successful
+    MCP2515Error begin(const BitTiming &timing);
+
     /// @brief Setup MCP2515 with a custom set of cnf values
     /// @param cnf1 The value of the CNF1 register
     /// @param cnf2 The value of the CNF2 register
@@ -228,6 +387,30 @@ public:
     /// @return MCP2515Error::OK if successful
     MCP2515Error begin(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3);
 
+    /// @brief Start the setup without blocking, call poll() until it returns something else than PENDING
+    /// @param baudRate The baudrate to use
+    /// @return MCP2515Error::PENDING if the setup was started
+    MCP2515Error beginAsync(CanSpeed baudRate);
+
+    /// @brief Start the setup with a computed bit timing without blocking
+    /// @param timing The bit timing, see calcBitTiming() and bitTiming()
+    /// @return MCP2515Error::PENDING if the setup was started, FAILINIT for an invalid timing
+    MCP2515Error beginAsync(const BitTiming &timing);
+
+    /// @brief Start the setup with a custom set of cnf values without blocking
+    /// The chip stays in configuration mode for the whole setup, bit timing, filters and interrupts
+    /// are written in one burst as soon as the chip is out of reset.
+    /// @param cnf1 The value of the CNF1 register
+    /// @param cnf2 The value of the CNF2 register
+    /// @param cnf3 The value of the CNF3 register
+    /// @return MCP2515Error::PENDING if the setup was started
+    MCP2515Error beginAsync(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3);
+
+    /// @brief Continue the setup started by beginAsync(), each call takes at most a few SPI transactions
+    /// @return MCP2515Error::PENDING while the setup is running, OK once the chip is in normal mode,
+    /// FAILINIT if the chip does not respond or beginAsync() was not called
+    MCP2515Error poll();
+
     /// @brief Reset and put MCP2515 in sleep mode
     void end();
 
@@ -246,7 +429,24 @@ public:
     /// @brief Clear overflow and message error flags
     void clearErrorFlags();
 
-    /// @brief Set the SPI clock frequency
+#ifdef MCP2515_ENABLE_STATISTICS
+    /// @brief Return a copy of the driver counters
+    /// Overflows and error events are counted when the interrupt handler or getErrorFlags() sees them.
+    /// @return The counters since begin() or the last resetStatistics()
+    Statistics getStatistics();
+
+    /// @brief Set all driver counters to zero
+    void resetStatistics();
+#endif
+
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    /// @brief Record every SPI transaction of the driver
+    /// Costs three micros() calls per transaction while a trace is set.
+    /// @param trace The trace to record into, nullptr stops recording
+    void setSpiTrace(SpiTrace *trace) { _spiTrace = trace; }
+#endif
+
+    /// @brief Set the SPI clock frequency, not used with a custom transport
     /// @param frequency The SPI clock frequency in Hz
     void setSPIFrequency(uint32_t frequency);
 
@@ -255,6 +455,11 @@ public:
     /// @return MCP2515Error::OK if successful
     MCP2515Error setBitrate(CanSpeed speed);
 
+    /// @brief Set the CAN baudrate using a computed bit timing
+    /// @param timing The bit timing, see calcBitTiming() and bitTiming()
+    /// @return MCP2515Error::OK if successful
+    MCP2515Error setBitrate(const BitTiming &timing);
+
     /// @brief Set the CAN baudrate using a custom set of cnf values
     /// @param cnf1 The value of the CNF1 register
     /// @param cnf2 The value of the CNF2 register
@@ -277,7 +482,20 @@ public:
     /// @return MCP2515Error::OK if successful
     MCP2515Error setFilter(const RXF num, bool extended, uint32_t filter);
 
+    /// @brief Write a set of mask and filter changes
+    /// Configuration mode is entered once, consecutive changed registers are written in a single burst
+    /// and the previous mode is restored at the end.
+    /// @param config The collected changes
+    /// @return MCP2515Error::OK if successful
+    MCP2515Error applyFilterConfig(const FilterConfig &config);
+
+    /// @brief Write the masks and filters computed by planFilters()
+    /// @param plan The mask and filter values
+    /// @return MCP2515Error::OK if successful, MCP2515Error::FAIL if the plan is not valid
+    MCP2515Error applyFilterPlan(const FilterPlan &plan);
+
     /// @brief Get the current CAN mode
+    /// Reads CANSTAT, the controller can change the mode on its own, i.e. on wake-up
     /// @return The current CAN mode
     CanModes getMode();
 
@@ -301,9 +519,24 @@ public:
     /// @return MCP2515Error::OK if successful
     MCP2515Error setNormalMode();
 
+    /// @brief Request an operation mode without waiting for the MCP2515 to reach it
+    /// @param mode The requested mode
+    /// @return MCP2515Error::OK if the MCP2515 is in the mode already, PENDING otherwise
+    MCP2515Error requestMode(CanModes mode);
+
+    /// @brief Check if the mode of the last requestMode() is reached, reads CANSTAT at most once per call
+    /// @return MCP2515Error::OK once the mode is reached, PENDING while waiting, FAIL if it is not reached within 10 ms
+    MCP2515Error modeReached();
+
+    /// @brief Limit the CANSTAT reads of modeReached() and the blocking mode changes
+    /// @param us The minimum time between two reads in microseconds, 0 reads on every call (default)
+    void setModePollInterval(uint16_t us);
+
     /// @brief Enable the wake-up low pass filter
+    /// WAKFIL lives in CNF3, which can only be written in configuration mode. In any other mode a change
+    /// switches to configuration mode and back, which keeps the controller off the bus for up to twice
+    /// the 10 ms mode timeout. Call it in configuration mode to avoid that, an unchanged value costs no switch.
     /// @param enable True if the low pass filter should be enabled
-    /// @return MCP2515Error::OK if successful
     void setWakeupFilter(bool enable);
 
     /// @brief Enable one-shot mode for tx 
@@ -312,6 +545,8 @@ public:
     void setOneShotMode(bool enable);
 
     /// @brief Setup the clock output of the MCP2515
+    /// Switching between CLKOUT_SOF and a divisor changes CNF3.SOF, with the same configuration mode
+    /// round trip as setWakeupFilter(). Enabling, disabling and changing the divisor do not need it.
     /// @param divisor The clock divisor
     void setClockOut(const CanClkOut divisor);
 
@@ -319,6 +554,12 @@ public:
     /// @param enable True if rollover should be enabled
     void setRxBufferRollover(bool enable);
 
+    /// @brief Install a second acceptance stage behind the hardware filters
+    /// Messages rejected by the filter are dropped after reading their header, they are
+    /// neither copied nor queued. The filter is not copied and has to stay valid.
+    /// @param filter The filter, nullptr to remove it
+    void setSoftwareFilter(const SoftwareFilter *filter);
+
     /// @brief Check if a new message is available in any of the rx buffers
     /// @return true if a new message is available
     bool checkMessage();
@@ -328,28 +569,207 @@ public:
     /// @return MCP2515Error::OK if successful
     MCP2515Error readMessage(MCP2515CanPaket &packet);
 
+    /// @brief Read all pending messages with a single status poll
+    /// Both rx buffers are read back-to-back, in interrupt mode the rx queue is drained.
+    /// @param packets Array to store the messages
+    /// @param max The size of the array
+    /// @return The number of messages stored in the array
+    size_t readMessages(MCP2515CanPaket packets[], size_t max);
+
     /// @brief Send a CAN message
+    /// If all tx buffers are busy, the message is put into the async tx queue
+    /// (not available if MCP2515_DISABLE_ASYNC_TX_QUEUE is defined)
     /// @param packet The message to send
-    /// @return MCP2515Error::OK if successful
+    /// @return MCP2515Error::OK if the message was written to a tx buffer or queued,
+    ///         MCP2515Error::ALLTXBUSY if all tx buffers and the queue are full
     MCP2515Error sendMessage(const CANPacket &packet);
 
+    /// @brief Send several CAN messages at once
+    /// The free tx buffers are loaded in order and started with a single RTS instruction,
+    /// the remaining messages are put into the async tx queue (if available).
+    /// @param packets The messages to send, in transmission order
+    /// @param n The number of messages
+    /// @return The number of messages written to a tx buffer or queued. Sending stops at the
+    ///         first invalid message or when all tx buffers and the queue are full.
+    size_t sendMessages(const CANPacket packets[], size_t n);
+
+    /// @brief Send a CAN message and return a handle to track it
+    /// @param packet The message to send
+    /// @param handle Handle of the message, invalid if the message was not accepted
+    /// @return Same as sendMessage(const CANPacket &)
+    MCP2515Error sendMessage(const CANPacket &packet, TxHandle &handle);
+
+    /// @brief Return the transmission status of a message
+    /// Pending messages cost one register read, queued and completed ones none.
+    /// @param handle The handle returned by sendMessage()
+    /// @return The current status
+    TxStatus getTxStatus(const TxHandle &handle);
+
+    /// @brief Wait until a message was sent or aborted
+    /// Without interrupts the async tx queue is processed while waiting.
+    /// @param handle The handle returned by sendMessage()
+    /// @param timeout The maximum time to wait in milliseconds
+    /// @return The last status, TX_SENT, TX_ABORTED or TX_UNKNOWN unless the timeout expired
+    TxStatus waitTxStatus(const TxHandle &handle, uint32_t timeout);
+
+    /// @brief Abort a queued or pending message
+    /// A message that is on the bus already will still be sent, check with getTxStatus()
+    /// @param handle The handle returned by sendMessage()
+    /// @return MCP2515Error::OK if the message was removed from the queue or the abort was requested,
+    ///         MCP2515Error::FAIL if the message is done already
+    MCP2515Error abortMessage(const TxHandle &handle);
+
+    /// @brief Abort all queued and pending messages
+    void abortAllMessages();
+
+    /// @brief Select the order in which messages are sent
+    /// Set before sending, the pending and queued messages are not reordered.
+    /// @param mode The scheduling mode
+    void setTxScheduling(TxScheduling mode);
+
+    /// @brief Return the number of messages waiting in the async tx queue
+    /// @return The number of queued messages
+    size_t getTxQueueLength();
+
+    /// @brief Move queued messages into free tx buffers
+    /// Call periodically from loop(), if handleInterrupt() is not called on the INT pin
+    void processTxQueue();
+
+    /// @brief Service the interrupt flags of the MCP2515
+    /// Call from the interrupt service routine of the INT pin. Completed transmissions
+    /// are acknowledged and the async tx queue is drained into the free tx buffers.
+    /// In interrupt mode received messages are moved into the rx queue.
+    /// While the driver is in the middle of a tx operation, the call returns at once and
+    /// the operation runs the handler when it is done.
+    void handleInterrupt();
+
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    /// @brief Enable interrupt mode
+    /// An interrupt handler is attached to the INT pin, which moves received messages into the rx queue
+    /// as soon as they arrive. readMessage() and processRxQueue() then take the messages from the queue.
+    /// @attention Only one MCP2515 instance can use interrupt mode
+    void enableInterrupts();
+
+    /// @brief Leave interrupt mode and detach the handler from the INT pin
+    void disableInterrupts();
+
+    /// @brief Register a callback for received messages and enable interrupt mode
+    /// The callback is invoked from processRxQueue(), i.e. in loop() context, not from the interrupt.
+    /// @param callback The function to call for every received message, nullptr to remove it
+    void onReceivePacket(void (*callback)(const MCP2515CanPaket &packet));
+#endif
+
+    /// @brief Route received messages to the handlers of a dispatcher
+    /// readMessage(), readMessages() and processRxQueue() pass every message to the dispatcher first and only
+    /// return the messages no handler took, in polling and in interrupt mode.
+    /// The dispatcher is not copied, it has to stay valid as long as it is set.
+    /// @param dispatcher The dispatcher, nullptr to remove it
+    void setDispatcher(FrameDispatcher *dispatcher);
+
+    /// @brief Deliver all received messages to the dispatcher and the onReceivePacket() callback
+    /// Messages neither took are counted by FrameDispatcher::unhandled() and dropped. Call periodically from loop()
+    void processRxQueue();
+
 protected:
     inline void spiEnable();
     inline void spiDisable();
+    inline uint8_t spiTransfer(uint8_t data);
+    inline void spiTransfer(uint8_t buf[], size_t n);
+    inline void spiWrite(const uint8_t buf[], size_t n);
+    inline void spiTransferAsync(uint8_t buf[], size_t n, MCP2515Transport::Callback done);
+    inline void countErrors(uint8_t eflg, uint8_t intf);
+    inline void stampCapture(uint8_t rxStatus);
+    inline void stampDequeue(MCP2515CanPaket packets[], size_t n);
+    inline bool dispatched(const MCP2515CanPaket &packet);
+    MCP2515Error receiveMessage(MCP2515CanPaket &packet);
+    inline void waitTransport();
     MCP2515Error reset();
+    void resetChip();
+    bool resetDone();
+    void stageDefaults(internal::RegisterBatch &batch) const;
 
     uint8_t readRegister(const uint8_t address);
     void readRegisters(const uint8_t address, uint8_t val[], const uint8_t n);
     void setRegister(const uint8_t address, const uint8_t value);
     void setRegisters(const uint8_t address, const uint8_t values[], const uint8_t n);
     void modifyRegister(const uint8_t address, const uint8_t mask, const uint8_t value);
+    MCP2515Error modifyConfigRegister(const uint8_t address, const uint8_t mask, const uint8_t value);
+
+    /// @brief Write all updates of a batch, consecutive registers as one WRITE burst
+    /// Registers which are known to hold the value already are skipped. A partial update of a
+    /// register, which is not known, is written with BIT MODIFY.
+    /// @param batch The collected updates
+    /// @param configMode True if the controller is in configuration mode, short gaps of known registers are rewritten then
+    void writeBatch(const internal::RegisterBatch &batch, bool configMode = false);
+    bool batchChanges(const internal::RegisterBatch &batch) const;
+    bool batchValue(const internal::RegisterBatch::Entry &entry, uint8_t &value) const;
+    bool knownValue(const uint8_t address, uint8_t &value) const;
     uint8_t getStatus();
+    uint8_t getRxStatus();
+    bool intAsserted();
+    uint8_t pollRxStatus();
+
+    /// @brief Returns the RX STATUS byte of the rx buffer
+    /// With both buffers full, RX STATUS describes RXB0 and the status of RXB1 is read from RXB1CTRL.
+    uint8_t bufferStatus(internal::RXBn rxbn, uint8_t rxStatus);
+
+    /// @brief Returns the filter, which accepted the message, from the RX STATUS byte
+    static constexpr uint8_t filterHit(uint8_t rxStatus) {
+        return ((rxStatus & internal::RXSTATUS_FILHIT) >= internal::RXSTATUS_FILHIT_ROLLOVER) ?
+            (rxStatus & internal::RXSTATUS_FILHIT) - internal::RXSTATUS_FILHIT_ROLLOVER :
+            (rxStatus & internal::RXSTATUS_FILHIT);
+    }
 
     inline MCP2515Error setMode(const internal::CanctrlReqopMode mode);
 
-    MCP2515Error readMessage(internal::RXBn rxbn, MCP2515CanPaket &packet);
-    MCP2515Error sendMessage(internal::TXBn txbn, const CANPacket &packet);
+    static constexpr uint32_t oscillatorFrequency(CanClock clk) {
+        return clk == MCP_20MHZ ? 20000000UL :
+            clk == MCP_16MHZ ? 16000000UL :
+            clk == MCP_12MHZ ? 12000000UL : 8000000UL;
+    }
+    BitTiming speedTiming(CanSpeed speed) const;
+    template<uint32_t Oscillator>
+    static BitTiming speedTiming(CanSpeed speed);
+
+    MCP2515Error readMessage(internal::RXBn rxbn, uint8_t rxStatus, MCP2515CanPaket &packet);
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    void receiveToQueue(internal::RXBn rxbn, uint8_t rxStatus);
+    void receiveAsync(internal::RXBn rxbn, uint8_t rxStatus);
+    static void receiveComplete(void *context);
+    static void isr();
+#endif
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    uint32_t rxTimestamp(uint32_t capture) const;
+    static void sofIsr();
+#endif
+    /// @brief Message in a tx buffer or the async tx queue
+    struct TxEntry {
+        CANPacket packet;
+        uint16_t seq;
+    };
+
+    MCP2515Error sendMessage(const CANPacket &packet, TxHandle *handle);
+    void loadTxBuffer(internal::TXBn txbn, const TxEntry &entry, uint8_t priority);
+    void requestToSend(uint8_t rts);
+    static uint32_t arbitrationKey(const CANPacket &packet);
+    int8_t nextTxBuffer(uint8_t status, uint32_t key, uint8_t &priority);
+    bool raiseTxPriorities(uint8_t status);
+    MCP2515Error scheduleTx(const CANPacket &packet, uint8_t &status, uint8_t &rts, TxHandle *handle);
+    void markAborted(uint16_t seq);
+    void serviceTx(uint8_t status);
+    void serviceInterrupt();
+    inline void deferInterrupt();
+    void resumeInterrupt();
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    uint8_t drainTxQueue(uint8_t status);
+    bool queueTx(const TxEntry &entry, bool requeue);
+    bool preemptTx(uint8_t &status, uint32_t key, uint8_t &rts);
+    void resolveAborts(uint8_t status);
+    void armTxInterrupts();
+#endif
 
+    static void encodeId(uint32_t id, bool extended, uint8_t buf[4]);
+    static uint32_t decodeId(const uint8_t buf[4], bool &extended);
     static std::array<uint8_t, CANPacket::MAX_DATA_LENGTH + 5> serialize(const CANPacket &packet);
     
     static constexpr size_t nTxBuffers = 3;
@@ -357,10 +777,12 @@ protected:
         uint8_t CTRL;
         uint8_t SIDH;
         uint8_t DATA;
+        uint8_t LOAD;
+        uint8_t RTS;
     } TXB[nTxBuffers] = {
-        {internal::MCP_TXB0CTRL, internal::MCP_TXB0SIDH, internal::MCP_TXB0DATA},
-        {internal::MCP_TXB1CTRL, internal::MCP_TXB1SIDH, internal::MCP_TXB1DATA},
-        {internal::MCP_TXB2CTRL, internal::MCP_TXB2SIDH, internal::MCP_TXB2DATA},
+        {internal::MCP_TXB0CTRL, internal::MCP_TXB0SIDH, internal::MCP_TXB0DATA, internal::INSTRUCTION_LOAD_TX0, internal::INSTRUCTION_RTS_TX0},
+        {internal::MCP_TXB1CTRL, internal::MCP_TXB1SIDH, internal::MCP_TXB1DATA, internal::INSTRUCTION_LOAD_TX1, internal::INSTRUCTION_RTS_TX1},
+        {internal::MCP_TXB2CTRL, internal::MCP_TXB2SIDH, internal::MCP_TXB2DATA, internal::INSTRUCTION_LOAD_TX2, internal::INSTRUCTION_RTS_TX2},
     };
 
     static constexpr size_t nRxBuffers = 2;
@@ -369,15 +791,113 @@ protected:
         uint8_t SIDH;
         uint8_t DATA;
         uint8_t CANINTF_RXnIF;
+        uint8_t READ;
     } RXB[nRxBuffers] = {
-        {internal::MCP_RXB0CTRL, internal::MCP_RXB0SIDH, internal::MCP_RXB0DATA, internal::CANINTF_RX0IF},
-        {internal::MCP_RXB1CTRL, internal::MCP_RXB1SIDH, internal::MCP_RXB1DATA, internal::CANINTF_RX1IF}
+        {internal::MCP_RXB0CTRL, internal::MCP_RXB0SIDH, internal::MCP_RXB0DATA, internal::CANINTF_RX0IF, internal::INSTRUCTION_READ_RX0},
+        {internal::MCP_RXB1CTRL, internal::MCP_RXB1SIDH, internal::MCP_RXB1DATA, internal::CANINTF_RX1IF, internal::INSTRUCTION_READ_RX1}
     };
 
-    uint8_t _csPin;
+    uint8_t _intPin{MCP2515_DEFAULT_INT_PIN};
+    bool _intPolling{false};
+    int8_t _rxbfPin[nRxBuffers]{-1, -1};
     CanClock _clockFrequency;
-    SPISettings _spiSettings{4000000, MSBFIRST, SPI_MODE0};
-    SPIClass &_spi;
+
+    internal::CanctrlReqopMode _modeRequest{internal::CANCTRL_REQOP_CONFIG};
+    MCP2515Error _modeResult{MCP2515Error::OK};
+    uint32_t _modeRequestedAt{0};
+    uint32_t _modeLastPoll{0};
+    uint16_t _modePollInterval{0};
+
+    enum InitState: uint8_t { INIT_IDLE, INIT_RESET, INIT_MODE, INIT_DONE, INIT_FAILED };
+    InitState _initState{INIT_IDLE};
+    uint32_t _initStart{0};
+    uint8_t _initCnf[3]{};      ///< CNF3, CNF2, CNF1
+    MCP2515Transport *_transport;
+    uint8_t _txTransfer[3 + 5 + CANPacket::MAX_DATA_LENGTH];   ///< WRITE, TXBnCTRL, TXP, frame
+
+    const SoftwareFilter *_softwareFilter{nullptr};
+
+    uint8_t _txPriority[nTxBuffers]{};
+    uint32_t _txKey[nTxBuffers]{};
+    TxScheduling _txScheduling{TX_PRIORITY};
+    bool _oneShot{false};
+    uint16_t _txSeq[nTxBuffers]{};
+    uint16_t _txNextSeq{1};
+    uint8_t _txAborted[8]{};
+    uint8_t _txAbortRequested{0};
+#ifndef MCP2515_DISABLE_ASYNC_TX_QUEUE
+    RingBuffer<TxEntry, MCP2515_CANPACKET_TX_QUEUE_SIZE> _txQueue;
+    TxEntry _txPending[nTxBuffers];
+    uint8_t _txAborting{0};
+    bool _txInterrupts{false};      ///< TXnIE set, while messages wait in the queue
+#endif
+    FrameDispatcher *_dispatcher{nullptr};
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    RingBuffer<MCP2515CanPaket, MCP2515_CANPACKET_RX_QUEUE_SIZE> _rxQueue;
+    void (*_onReceive)(const MCP2515CanPaket &packet){nullptr};
+    bool _interruptMode{false};
+    static MCP2515Driver *_isrInstance;
+    uint8_t _rxTransfer[1 + 5 + CANPacket::MAX_DATA_LENGTH];    ///< READ RX BUFFER, frame
+    uint8_t _rxTransferStatus{0};
+    internal::RXBn _rxTransferBuffer{internal::RXB0};
+#endif
+    volatile uint8_t _pendingErrorFlags{0};
+    volatile bool _intDeferring{false};     ///< handleInterrupt() only notes the INT, see deferInterrupt()
+    volatile bool _intDeferred{false};      ///< INT noted while deferring
+#ifndef MCP2515_DISABLE_REGISTER_SHADOW
+    internal::RegisterShadow _shadow;
+#endif
+#ifdef MCP2515_ENABLE_STATISTICS
+    Statistics _stats;
+    uint8_t _statsEflg{0};      ///< EFLG overflow flags counted, but not cleared yet
+    uint8_t _statsIntf{0};      ///< CANINTF error flags counted, but not cleared yet
+#endif
+#ifdef MCP2515_ENABLE_SPI_TRACE
+    SpiTrace *_spiTrace{nullptr};
+#endif
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+    uint32_t _rxCapture[nRxBuffers]{};  ///< Timestamp of the message in each rx buffer
+    uint8_t _rxCaptured{0};             ///< Rx buffers with a timestamp, kept until the buffer is read
+#ifndef MCP2515_DISABLE_ASYNC_RX_QUEUE
+    uint32_t _rxTransferMicros{0};
+#endif
+    int8_t _sofPin{-1};
+    volatile uint8_t _sofCount{0};      ///< Tells the valid entries of _sofMicros, changes with every SOF
+    uint32_t _sofMinMicros{0};          ///< Shortest time from SOF to the end of a frame
+    volatile uint32_t _sofMicros[2]{};  ///< Last and previous start of frame
+    static MCP2515Driver *_sofInstance;
+#endif
+
+protected:
+    SPITransport *_spiTransport{nullptr};   ///< The default transport, setPins() and setSPIFrequency() apply to it
+};
+
+namespace internal {
+
+/// @brief Holds the transport of a driver, so that it is constructed before the MCP2515Driver base class
+template<class Transport>
+struct TransportStorage {
+    explicit TransportStorage(const Transport &transport) : transport(transport) { }
+
+    Transport transport;
+};
+
+} // namespace internal
+
+/// @brief MCP2515 driver with the default transport, an Arduino SPIClass and a GPIO chip select
+class MCP2515 : private internal::TransportStorage<SPITransport>, public MCP2515Driver {
+    typedef internal::TransportStorage<SPITransport> Storage;
+public:
+    /// @brief MCP2515 constructor
+    /// @param cs The SPI chip select pin
+    /// @param clk The MCP2515 clock frequency (supported frequencies: 8MHz, 12Mhz, 16Mhz, 20Mhz)
+    /// @param spi The SPI object used for communication
+    MCP2515(int cs = MCP2515_DEFAULT_CS_PIN, CanClock clk = CanClock::MCP_8MHZ, SPIClass &spi = SPI) :
+        Storage(SPITransport(spi, cs)),
+        MCP2515Driver(Storage::transport, clk)
+    {
+        _spiTransport = &transport;
+    }
 };
 
 #endif
@@ -0,0 +1,57 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include "MCP2515.h"
+
+/// @brief MCP2515 driver with chip select pin, oscillator and SPI clock fixed at compile time
+/// Uses FastSPITransport and computes the bit timing at compile time, everything else is the MCP2515Driver class.
+/// setPins() and setSPIFrequency() have no effect, chip select and SPI clock are template parameters.
+/// @code
+/// MCP2515T<10, MCP2515::MCP_16MHZ, 10000000> MCP;
+/// MCP.begin<500000>();
+/// @endcode
+/// @tparam CsPin The chip select pin
+/// @tparam Clock The MCP2515 clock frequency
+/// @tparam SpiHz The SPI clock in Hz
+template<uint8_t CsPin, MCP2515::CanClock Clock = MCP2515::MCP_8MHZ, uint32_t SpiHz = 4000000>
+class MCP2515T : private internal::TransportStorage<FastSPITransport<CsPin, SpiHz>>, public MCP2515Driver {
+    typedef internal::TransportStorage<FastSPITransport<CsPin, SpiHz>> Storage;
+public:
+    /// The oscillator frequency in Hz
+    static constexpr uint32_t oscillator = MCP2515Driver::oscillatorFrequency(Clock);
+
+    /// @param spi The SPI object used for communication
+    explicit MCP2515T(SPIClass &spi = SPI) :
+        Storage(FastSPITransport<CsPin, SpiHz>(spi)),
+        MCP2515Driver(Storage::transport, Clock)
+    {
+    }
+
+    using MCP2515Driver::begin;
+    using MCP2515Driver::setBitrate;
+
+    /// @brief Setup MCP2515 with a bit timing computed at compile time, an unreachable bitrate does not compile
+    /// @tparam Bitrate The CAN bitrate in bit/s
+    /// @tparam SamplePoint The sample point in 1/1000 of the bit time
+    /// @tparam Sjw The synchronization jump width in time quanta (1..4)
+    /// @return MCP2515Error::OK if successful
+    template<uint32_t Bitrate, uint16_t SamplePoint = 875, uint8_t Sjw = 1>
+    MCP2515Error begin() {
+        return MCP2515Driver::begin(bitTiming<oscillator, Bitrate, SamplePoint, Sjw>());
+    }
+
+    /// @brief Set the CAN bitrate with a bit timing computed at compile time
+    /// @tparam Bitrate The CAN bitrate in bit/s
+    /// @tparam SamplePoint The sample point in 1/1000 of the bit time
+    /// @tparam Sjw The synchronization jump width in time quanta (1..4)
+    /// @return MCP2515Error::OK if successful
+    template<uint32_t Bitrate, uint16_t SamplePoint = 875, uint8_t Sjw = 1>
+    MCP2515Error setBitrate() {
+        return MCP2515Driver::setBitrate(bitTiming<oscillator, Bitrate, SamplePoint, Sjw>());
+    }
+};
@@ -0,0 +1,77 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace internal {
+
+/// @brief Collects register updates, which are written by MCP2515::writeBatch()
+/// Updates of the same register are merged into one, the entries are kept sorted by address,
+/// so that consecutive registers are written in a single WRITE burst.
+class RegisterBatch {
+public:
+    /// Enough for all filters and masks, BFPCTRL, CNF1..CNF3, CANINTE and both RXBnCTRL
+    static constexpr uint8_t capacity = 40;
+
+    struct Entry {
+        uint8_t address;
+        uint8_t mask;       ///< bits to change, 0xFF for a complete write
+        uint8_t value;
+    };
+
+    /// @brief Change some bits of a register
+    /// @param address The register address
+    /// @param mask The bits to change
+    /// @param value The new value of the bits
+    /// @return false if the batch is full
+    bool modify(uint8_t address, uint8_t mask, uint8_t value) {
+        uint8_t pos = 0;
+        while(pos < _count && _entries[pos].address < address)
+            pos++;
+
+        if(pos < _count && _entries[pos].address == address) {
+            Entry &e = _entries[pos];
+            e.value = (e.value & ~mask) | (value & mask);
+            e.mask |= mask;
+            return true;
+        }
+
+        if(_count >= capacity)
+            return false;
+        memmove(&_entries[pos + 1], &_entries[pos], (_count - pos) * sizeof(Entry));
+        _entries[pos] = Entry{address, mask, static_cast<uint8_t>(value & mask)};
+        _count++;
+        return true;
+    }
+
+    /// @brief Write a register
+    bool write(uint8_t address, uint8_t value) {
+        return modify(address, 0xFF, value);
+    }
+
+    /// @brief Write consecutive registers
+    bool write(uint8_t address, const uint8_t values[], uint8_t n) {
+        for(uint8_t i = 0; i < n; i++) {
+            if(!write(address + i, values[i]))
+                return false;
+        }
+        return true;
+    }
+
+    void clear() { _count = 0; }
+    bool empty() const { return _count == 0; }
+    uint8_t size() const { return _count; }
+    const Entry &operator[](uint8_t i) const { return _entries[i]; }
+
+private:
+    Entry _entries[capacity];
+    uint8_t _count{0};
+};
+
+} // namespace internal
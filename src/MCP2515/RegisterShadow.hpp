@@ -0,0 +1,145 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "mcp2515_def.h"
+
+namespace internal {
+
+/// @brief RAM copy of the configuration registers of the MCP2515
+/// Covers the filters and masks, CNF1..CNF3, CANINTE, RXB0CTRL, RXB1CTRL and CANCTRL. Only
+/// values written by the driver are known, a register is unknown until it is written after a reset.
+class RegisterShadow {
+public:
+    /// @brief Registers after a RESET instruction, filters and masks are undefined
+    void reset() {
+        for(auto &v : _valid)
+            v = 0;
+        store(MCP_CANCTRL, CANCTRL_REQOP_CONFIG | CANCTRL_CLKEN | CANCTRL_CLKPRE);
+        store(MCP_CNF1, 0x00);
+        store(MCP_CNF2, 0x00);
+        store(MCP_CNF3, 0x00);
+        store(MCP_CANINTE, 0x00);
+        store(MCP_RXB0CTRL, 0x00);
+        store(MCP_RXB1CTRL, 0x00);
+    }
+
+    /// @brief Forget all registers
+    void invalidate() {
+        for(auto &v : _valid)
+            v = 0;
+    }
+
+    /// @brief Get a register, which has no bits that are changed by the chip
+    /// @param address The register address
+    /// @param value The register value
+    /// @return true if the value is known
+    bool read(uint8_t address, uint8_t &value) const {
+        int8_t s = slot(address);
+        if(s < 0 || !valid(s) || readOnlyBits(s) || volatileBits(s))
+            return false;
+        value = _regs[s];
+        return true;
+    }
+
+    /// @brief Get the value that rewrites a register without changing it
+    /// Read-only bits are included as written, the chip ignores them
+    /// @param address The register address
+    /// @param value The register value
+    /// @return true if the value is known
+    bool value(uint8_t address, uint8_t &value) const {
+        int8_t s = slot(address);
+        if(s < 0 || !valid(s) || volatileBits(s))
+            return false;
+        value = _regs[s];
+        return true;
+    }
+
+    /// @brief Check if a register value is known
+    bool known(uint8_t address) const {
+        int8_t s = slot(address);
+        return s >= 0 && valid(s);
+    }
+
+    /// @brief Check if a BIT MODIFY would change a register
+    /// @param address The register address
+    /// @param mask The bits to modify
+    /// @param value The new value of the bits
+    /// @return false if the register is known to hold the value already
+    bool changes(uint8_t address, uint8_t mask, uint8_t value) const {
+        int8_t s = slot(address);
+        if(s < 0 || !valid(s))
+            return true;
+        // writable bits changed by the chip itself are always written, read-only bits never matter
+        if(mask & volatileBits(s))
+            return true;
+        return (_regs[s] ^ value) & mask & ~readOnlyBits(s);
+    }
+
+    /// @brief Record a BIT MODIFY (or WRITE, with mask 0xFF)
+    void modify(uint8_t address, uint8_t mask, uint8_t value) {
+        int8_t s = slot(address);
+        if(s < 0)
+            return;
+        _regs[s] = (_regs[s] & ~mask) | (value & mask);
+        if(mask == 0xFF)
+            _valid[s >> 3] |= (1 << (s & 0x07));
+    }
+
+    void store(uint8_t address, uint8_t value) {
+        modify(address, 0xFF, value);
+    }
+
+private:
+    static constexpr uint8_t nSlots = 39;
+    static constexpr int8_t SLOT_RXB0CTRL = 36;
+    static constexpr int8_t SLOT_RXB1CTRL = 37;
+    static constexpr int8_t SLOT_CANCTRL = 38;
+
+    /// RXF0..RXF2 (0x00), RXF3..RXF5 (0x10), RXM0, RXM1, CNF3..CNF1, CANINTE (0x20), RXBnCTRL and CANCTRL
+    static int8_t slot(uint8_t address) {
+        uint8_t block = address >> 4;
+        uint8_t offset = address & 0x0F;
+        if(offset == 0x0F)
+            return SLOT_CANCTRL;    // CANCTRL is mapped into every block
+        if(block <= 2)
+            return offset < 12 ? block * 12 + offset : -1;
+        if(address == MCP_RXB0CTRL)
+            return SLOT_RXB0CTRL;
+        if(address == MCP_RXB1CTRL)
+            return SLOT_RXB1CTRL;
+        return -1;
+    }
+
+    /// RXRTR, BUKT1 and FILHIT are set by received messages
+    static uint8_t readOnlyBits(int8_t s) {
+        switch(s) {
+            case SLOT_RXB0CTRL:
+                return RXB_CTRL_RTR | 0x02 | RXB_0_CTRL_FILHIT;
+            case SLOT_RXB1CTRL:
+                return RXB_CTRL_RTR | RXB_1_CTRL_FILHIT;
+            default:
+                return 0;
+        }
+    }
+
+    /// REQOP changes on wake-up
+    static uint8_t volatileBits(int8_t s) {
+        return s == SLOT_CANCTRL ? CANCTRL_REQOP : 0;
+    }
+
+    bool valid(int8_t s) const {
+        return _valid[s >> 3] & (1 << (s & 0x07));
+    }
+
+    uint8_t _regs[nSlots]{};
+    uint8_t _valid[(nSlots + 7) / 8]{};
+};
+
+} // namespace internal
@@ -0,0 +1,96 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stdint.h>
+
+/// @brief Fixed size single producer / single consumer ring buffer
+/// One side may run in interrupt context, as long as there is exactly one producer and one consumer.
+/// The indices are 8 bit wide, so that they are updated atomically on 8 bit MCUs.
+/// @tparam T The element type
+/// @tparam N The capacity, a power of two up to 128
+template<typename T, uint8_t N>
+class RingBuffer {
+    static_assert(N > 0 && N <= 128 && (N & (N - 1)) == 0, "RingBuffer capacity must be a power of two up to 128");
+
+public:
+    /// @brief Returns true if no element is stored
+    bool empty() const { return _head == _tail; }
+
+    /// @brief Returns true if no more elements can be stored
+    bool full() const { return size() == N; }
+
+    /// @brief Returns the number of stored elements
+    uint8_t size() const { return static_cast<uint8_t>(_head - _tail); }
+
+    /// @brief Returns the maximum number of elements
+    static constexpr uint8_t capacity() { return N; }
+
+    /// @brief Append an element (producer side)
+    /// @param item The element to append
+    /// @return true if the element was stored, false if the buffer is full
+    bool push(const T &item) {
+        if(full())
+            return false;
+        _buffer[_head & (N - 1)] = item;
+        barrier();
+        _head = _head + 1;
+        return true;
+    }
+
+    /// @brief Access the next free slot, to fill it in place (producer side)
+    /// @return Pointer to the free slot, nullptr if the buffer is full
+    T *reserve() { return full() ? nullptr : &_buffer[_head & (N - 1)]; }
+
+    /// @brief Publish the slot returned by reserve() (producer side)
+    void commit() {
+        if(full())
+            return;
+        barrier();
+        _head = _head + 1;
+    }
+
+    /// @brief Access the oldest element (consumer side)
+    /// @return Pointer to the oldest element, nullptr if the buffer is empty
+    T *front() { return empty() ? nullptr : &_buffer[_tail & (N - 1)]; }
+
+    /// @brief Access a stored element
+    /// Only safe while the other side is kept out, e.g. with its interrupt handler held back
+    /// @param i The position, 0 is the oldest element
+    /// @return Reference to the element
+    T &operator[](uint8_t i) { return _buffer[(_tail + i) & (N - 1)]; }
+
+    /// @brief Remove the oldest element (consumer side)
+    void pop() {
+        if(empty())
+            return;
+        barrier();
+        _tail = _tail + 1;
+    }
+
+    /// @brief Remove and return the oldest element (consumer side)
+    /// @param item Reference to store the element
+    /// @return true if an element was removed, false if the buffer is empty
+    bool pop(T &item) {
+        if(empty())
+            return false;
+        item = _buffer[_tail & (N - 1)];
+        pop();
+        return true;
+    }
+
+    /// @brief Drop all elements (consumer side)
+    void clear() { _tail = _head; }
+
+private:
+    // keeps the compiler from moving element accesses across the index update
+    static inline void barrier() { __asm__ __volatile__("" ::: "memory"); }
+
+    T _buffer[N];
+    volatile uint8_t _head{0};
+    volatile uint8_t _tail{0};
+};
@@ -0,0 +1,114 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include "Histogram.hpp"
+#include "MCP2515.h"
+
+#ifdef MCP2515_ENABLE_RX_TIMESTAMP
+
+/// @brief Latency and jitter of received messages per CAN id
+/// Every id gets an entry of the table on its first message, messages of further ids are only counted.
+/// The latency is the time from reception until the application took the message, the jitter the
+/// change of the time between two messages of an id, i.e. of a cyclic message.
+class RxLatency {
+public:
+    typedef Log2Histogram<16> Histogram;
+
+    /// @brief Timing of one CAN id
+    struct Entry {
+        uint32_t id{0};
+        bool extended{false};
+        uint32_t count{0};              ///< Messages seen, 0 marks a free entry
+        uint32_t lastRx{0};             ///< Reception timestamp of the last message
+        uint32_t lastPeriod{0};         ///< Microseconds between the last two messages
+        uint32_t minPeriod{0xFFFFFFFF};
+        uint32_t maxPeriod{0};
+        uint32_t maxLatency{0};
+        Histogram latency;              ///< Reception until dequeue in microseconds
+        Histogram jitter;               ///< Change of the period in microseconds
+
+        /// @brief Returns the largest difference between two periods
+        uint32_t periodSpread() const { return count > 2 ? maxPeriod - minPeriod : 0; }
+    };
+
+    /// @param table The entries, not copied, it has to stay valid as long as it is used
+    /// @param length The number of elements of table
+    RxLatency(Entry table[], uint16_t length) : _table(table), _length(length) { }
+
+    /// @brief Account a received message, call when the application takes the message
+    /// @param packet The message, with timestamps
+    /// @return false if the table is full and the id has no entry
+    bool add(const MCP2515CanPaket &packet) {
+        Entry *entry = slot(packet.id(), packet.extended());
+        if(!entry) {
+            _untracked++;
+            return false;
+        }
+
+        const uint32_t rx = packet.getRxTimestamp();
+        const uint32_t latency = packet.getLatency();
+        entry->latency.add(latency);
+        if(latency > entry->maxLatency)
+            entry->maxLatency = latency;
+
+        if(entry->count) {
+            const uint32_t period = rx - entry->lastRx;
+            if(entry->count > 1)
+                entry->jitter.add(period > entry->lastPeriod ? period - entry->lastPeriod : entry->lastPeriod - period);
+            if(period < entry->minPeriod)
+                entry->minPeriod = period;
+            if(period > entry->maxPeriod)
+                entry->maxPeriod = period;
+            entry->lastPeriod = period;
+        }
+        entry->lastRx = rx;
+        entry->count++;
+        return true;
+    }
+
+    /// @brief Returns the entry of an id, nullptr if no message of the id was seen
+    const Entry *find(uint32_t id, bool extended = false) const {
+        for(uint16_t i = 0; i < _length && _table[i].count; i++) {
+            if(_table[i].id == id && _table[i].extended == extended)
+                return &_table[i];
+        }
+        return nullptr;
+    }
+
+    /// @brief Returns the number of messages without a table entry
+    uint32_t untracked() const { return _untracked; }
+
+    /// @brief Drop all entries
+    void clear() {
+        for(uint16_t i = 0; i < _length; i++)
+            _table[i] = Entry{};
+        _untracked = 0;
+    }
+
+private:
+    Entry *slot(uint32_t id, bool extended) {
+        // entries are taken in order, the first free one ends the search
+        for(uint16_t i = 0; i < _length; i++) {
+            Entry &entry = _table[i];
+            if(!entry.count) {
+                entry.id = id;
+                entry.extended = extended;
+                return &entry;
+            }
+            if(entry.id == id && entry.extended == extended)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    Entry *_table;
+    uint16_t _length;
+    uint32_t _untracked{0};
+};
+
+#endif
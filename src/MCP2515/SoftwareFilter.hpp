@@ -0,0 +1,119 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/// @brief Second acceptance stage, applied by the driver after the hardware filters
+/// Standard ids are looked up in a 2048 bit bitmap, extended ids are kept in a sorted table
+/// which is searched binary. Frames which are not accepted are dropped after reading their
+/// header, before the data is read and before they are copied or queued.
+class SoftwareFilter {
+public:
+    /// @brief Create an empty filter for standard ids, which rejects everything
+    SoftwareFilter() : SoftwareFilter(nullptr, 0) { }
+
+    /// @brief Create an empty filter, which rejects everything
+    /// @param extTable Storage for the extended ids, may be nullptr if only standard ids are used
+    /// @param extCapacity The number of elements of extTable
+    explicit SoftwareFilter(uint32_t extTable[], uint8_t extCapacity) : _ext(extTable), _extCapacity(extCapacity) {
+        clear();
+    }
+
+    /// @brief Reject all ids
+    void clear() {
+        memset(_std, 0, sizeof(_std));
+        _extCount = 0;
+    }
+
+    /// @brief Accept an id
+    /// @param id The CAN id
+    /// @param extended True if the id is an extended id
+    /// @return false if the extended table is full
+    bool allow(uint32_t id, bool extended) {
+        if(!extended) {
+            id &= 0x7FF;
+            _std[id >> 3] |= (1 << (id & 0x07));
+            return true;
+        }
+
+        uint8_t pos = lowerBound(id);
+        if(pos < _extCount && _ext[pos] == id)
+            return true;
+        if(_extCount >= _extCapacity)
+            return false;
+
+        memmove(&_ext[pos + 1], &_ext[pos], (_extCount - pos) * sizeof(_ext[0]));
+        _ext[pos] = id;
+        _extCount++;
+        return true;
+    }
+
+    /// @brief Accept a range of ids
+    /// @param first The first CAN id
+    /// @param last The last CAN id (inclusive)
+    /// @param extended True if the ids are extended ids
+    /// @return false if the extended table is full
+    bool allow(uint32_t first, uint32_t last, bool extended) {
+        for(uint32_t id = first; id <= last; id++) {
+            if(!allow(id, extended))
+                return false;
+            if(id == last)
+                break;
+        }
+        return true;
+    }
+
+    /// @brief Reject an id
+    /// @param id The CAN id
+    /// @param extended True if the id is an extended id
+    void block(uint32_t id, bool extended) {
+        if(!extended) {
+            id &= 0x7FF;
+            _std[id >> 3] &= ~(1 << (id & 0x07));
+            return;
+        }
+
+        uint8_t pos = lowerBound(id);
+        if(pos < _extCount && _ext[pos] == id) {
+            _extCount--;
+            memmove(&_ext[pos], &_ext[pos + 1], (_extCount - pos) * sizeof(_ext[0]));
+        }
+    }
+
+    /// @brief Check if an id is accepted
+    /// @param id The CAN id
+    /// @param extended True if the id is an extended id
+    /// @return true if the id is accepted
+    bool accepts(uint32_t id, bool extended) const {
+        if(!extended)
+            return _std[(id >> 3) & 0xFF] & (1 << (id & 0x07));
+
+        uint8_t pos = lowerBound(id);
+        return pos < _extCount && _ext[pos] == id;
+    }
+
+private:
+    uint8_t lowerBound(uint32_t id) const {
+        uint8_t lo = 0;
+        uint8_t hi = _extCount;
+        while(lo < hi) {
+            uint8_t mid = (lo + hi) / 2;
+            if(_ext[mid] < id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    uint8_t _std[2048 / 8];
+    uint32_t *_ext;
+    uint8_t _extCapacity;
+    uint8_t _extCount{0};
+};
@@ -0,0 +1,123 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Histogram.hpp"
+
+#ifndef MCP2515_SPI_TRACE_SIZE
+# define MCP2515_SPI_TRACE_SIZE 32
+#endif
+
+/// @brief Records the SPI transactions of the driver, see MCP2515::setSpiTrace()
+/// Keeps the last MCP2515_SPI_TRACE_SIZE transactions and a log2 histogram of the time every
+/// transaction took, from the request of the bus until chip select is released. The time spent
+/// waiting for the bus, i.e. while another SPI device or a running DMA transfer holds it, is kept
+/// separately in every record.
+class SpiTrace {
+    static_assert(MCP2515_SPI_TRACE_SIZE > 0 && MCP2515_SPI_TRACE_SIZE <= 128 &&
+        (MCP2515_SPI_TRACE_SIZE & (MCP2515_SPI_TRACE_SIZE - 1)) == 0, "MCP2515_SPI_TRACE_SIZE must be a power of two up to 128");
+
+public:
+    /// @brief One SPI transaction
+    struct Record {
+        uint32_t start{0};          ///< micros() when the driver requested the bus
+        uint16_t wait{0};           ///< Microseconds until chip select was pulled low
+        uint16_t duration{0};       ///< Microseconds from chip select low to high
+        uint8_t instruction{0};     ///< The first byte, the SPI instruction
+        uint8_t address{0};         ///< The second byte, the register address of READ, WRITE and BITMOD
+        uint8_t length{0};          ///< The number of bytes, saturates at 255
+        bool async{false};          ///< Started with transferAsync(), duration only covers the start
+
+        /// @brief Returns the time the driver spent in the transaction, waiting included
+        uint32_t latency() const { return static_cast<uint32_t>(wait) + duration; }
+    };
+
+    typedef Log2Histogram<16> Histogram;
+    static constexpr uint8_t nBins = Histogram::nBins;
+
+    /// @brief Returns the number of stored records
+    uint8_t size() const { return _count < MCP2515_SPI_TRACE_SIZE ? static_cast<uint8_t>(_count) : MCP2515_SPI_TRACE_SIZE; }
+
+    /// @brief Access a stored record, only consistent if no transaction runs meanwhile
+    /// @param i The position, 0 is the oldest record
+    const Record &operator[](uint8_t i) const {
+        return _records[(_next - size() + i) & (MCP2515_SPI_TRACE_SIZE - 1)];
+    }
+
+    /// @brief Returns the number of transactions recorded since the last clear()
+    uint32_t count() const { return _count; }
+
+    /// @brief Returns the number of transactions in a histogram bin
+    /// Bin 0 counts transactions below 1us, bin n those from 2^(n-1) up to 2^n - 1us, the last bin all longer ones
+    /// @param bin The bin (0..nBins-1)
+    uint32_t histogram(uint8_t bin) const { return _histogram[bin]; }
+
+    /// @brief Returns the histogram bin of a latency
+    /// @param micros The latency in microseconds
+    static uint8_t bin(uint32_t micros) { return Histogram::bin(micros); }
+
+    /// @brief Drop all records and the histogram
+    void clear() {
+        _next = 0;
+        _count = 0;
+        _histogram.clear();
+    }
+
+    /// @brief Start a record, called by the driver once chip select is low
+    /// @param start micros() when the bus was requested
+    /// @param selected micros() after chip select
+    void begin(uint32_t start, uint32_t selected) {
+        _current = Record{};
+        _current.start = start;
+        _current.wait = saturate(selected - start);
+        _selected = selected;
+    }
+
+    /// @brief Add bytes sent in the current transaction
+    void add(const uint8_t buf[], size_t n) {
+        size_t i = 0;
+        for(; i < n && _current.length < 2; i++)
+            add(buf[i]);
+        n -= i;
+        _current.length = (n > 255u - _current.length) ? 255 : static_cast<uint8_t>(_current.length + n);
+    }
+
+    /// @brief Add a byte sent in the current transaction
+    void add(uint8_t data) {
+        if(_current.length == 0)
+            _current.instruction = data;
+        else if(_current.length == 1)
+            _current.address = data;
+        if(_current.length < 255)
+            _current.length++;
+    }
+
+    /// @brief Store the current record, called by the driver after chip select is released
+    /// @param end micros() after chip select
+    /// @param async true if the transfer continues in the background
+    void end(uint32_t end, bool async = false) {
+        _current.duration = saturate(end - _selected);
+        _current.async = async;
+        _records[_next] = _current;
+        _next = (_next + 1) & (MCP2515_SPI_TRACE_SIZE - 1);
+        _count++;
+        _histogram.add(_current.latency());
+    }
+
+private:
+    static uint16_t saturate(uint32_t value) { return value > 0xFFFF ? 0xFFFF : static_cast<uint16_t>(value); }
+
+    Record _records[MCP2515_SPI_TRACE_SIZE];
+    Record _current;
+    uint32_t _selected{0};
+    Histogram _histogram;
+    uint32_t _count{0};
+    uint8_t _next{0};
+};
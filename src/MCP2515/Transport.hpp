@@ -0,0 +1,201 @@
+/**
+ * CAN MCP2515_nb
+ * Copyright 2024 laszloh, All Rights Reserved
+ *
+ * Licensed under Apache 2.0
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+/// @brief Byte transport between the driver and the MCP2515
+/// A SPI transaction is select(), any number of transfers and deselect(). Implement this interface
+/// to use a SPI peripheral with hardware chip select or DMA, the driver uses SPITransport by default.
+class MCP2515Transport {
+public:
+    /// @brief Called when an asynchronous transfer is done
+    typedef void (*Callback)(void *context);
+
+    virtual ~MCP2515Transport() = default;
+
+    /// @brief Setup the bus and the chip select pin, called by MCP2515::begin()
+    virtual void begin() = 0;
+
+    /// @brief Start a transaction, pull chip select low
+    virtual void select() = 0;
+
+    /// @brief Release chip select, end the transaction
+    virtual void deselect() = 0;
+
+    /// @brief Exchange one byte
+    virtual uint8_t transfer(uint8_t data) = 0;
+
+    /// @brief Exchange a block of bytes, the received bytes replace the sent ones
+    virtual void transfer(uint8_t buf[], size_t n) = 0;
+
+    /// @brief Send a block of bytes, the received bytes are dropped
+    virtual void write(const uint8_t buf[], size_t n) {
+        for(size_t i = 0; i < n; i++)
+            transfer(buf[i]);
+    }
+
+    /// @brief Run a complete transaction in the background
+    /// The buffer is exchanged in place and must stay untouched until the transfer is done. The driver
+    /// waits for busy() to return false before the next transaction. The default implementation
+    /// transfers synchronously and calls the callback before it returns.
+    /// @param buf The bytes to exchange
+    /// @param n The number of bytes
+    /// @param done Called exactly once when the transfer is done (may be nullptr), either from the interrupt
+    /// handler of the transport or from busy(), whichever sees the completion first
+    /// @param context Passed to the callback
+    virtual void transferAsync(uint8_t buf[], size_t n, Callback done, void *context) {
+        select();
+        transfer(buf, n);
+        deselect();
+        if(done)
+            done(context);
+    }
+
+    /// @brief Returns true if transferAsync() returns before the transfer is done
+    virtual bool async() const { return false; }
+
+    /// @brief Returns true while an asynchronous transfer is running
+    /// The completion callback has to run before this returns false. The driver also waits from its INT
+    /// handler, so busy() must poll the hardware and complete a finished transfer itself, it must not rely
+    /// on the interrupt of the transport to do so.
+    virtual bool busy() { return false; }
+
+    /// @brief Keep an interrupt handler, which uses the driver, out of running transactions
+    /// @param interruptNumber The interrupt number of the INT pin
+    virtual void usingInterrupt(int interruptNumber) { (void)interruptNumber; }
+    virtual void notUsingInterrupt(int interruptNumber) { (void)interruptNumber; }
+};
+
+namespace internal {
+
+/// @brief Data transfers over an Arduino SPIClass, chip select is left to the derived class
+class SPIClassTransport : public MCP2515Transport {
+public:
+    uint8_t transfer(uint8_t data) override {
+        return _spi.transfer(data);
+    }
+
+    void transfer(uint8_t buf[], size_t n) override {
+        _spi.transfer(buf, n);
+    }
+
+    void write(const uint8_t buf[], size_t n) override {
+        // SPIClass::transfer() overwrites the buffer
+        uint8_t chunk[16];
+        while(n) {
+            size_t len = (n < sizeof(chunk)) ? n : sizeof(chunk);
+            memcpy(chunk, buf, len);
+            _spi.transfer(chunk, len);
+            buf += len;
+            n -= len;
+        }
+    }
+
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+    void usingInterrupt(int interruptNumber) override { _spi.usingInterrupt(interruptNumber); }
+    void notUsingInterrupt(int interruptNumber) override { _spi.notUsingInterrupt(interruptNumber); }
+#endif
+
+protected:
+    explicit SPIClassTransport(SPIClass &spi) : _spi(spi) { }
+
+    SPIClass &_spi;
+};
+
+} // namespace internal
+
+/// @brief Transport over an Arduino SPIClass with a GPIO chip select
+class SPITransport : public internal::SPIClassTransport {
+public:
+    SPITransport(SPIClass &spi, uint8_t csPin) :
+        SPIClassTransport(spi),
+        _csPin(csPin)
+    {
+    }
+
+    /// @brief Change the chip select pin, must be called before begin()
+    void setPin(uint8_t csPin) { _csPin = csPin; }
+
+    /// @brief Change the SPI clock
+    void setFrequency(uint32_t frequency) { _settings = SPISettings(frequency, MSBFIRST, SPI_MODE0); }
+
+    void begin() override {
+        pinMode(_csPin, OUTPUT);
+        _spi.begin();
+    }
+
+    void select() override {
+        _spi.beginTransaction(_settings);
+        digitalWrite(_csPin, LOW);
+    }
+
+    void deselect() override {
+        digitalWrite(_csPin, HIGH);
+        _spi.endTransaction();
+    }
+
+private:
+    SPISettings _settings{4000000, MSBFIRST, SPI_MODE0};
+    uint8_t _csPin;
+};
+
+/// @brief Transport over an Arduino SPIClass with chip select pin and SPI clock fixed at compile time
+/// The SPISettings are constant and chip select is a direct port write on cores which provide portOutputRegister().
+/// On cores other than AVR, the port write is not atomic: the chip select pin must not share its port with pins
+/// written from interrupt handlers.
+/// @tparam CsPin The chip select pin
+/// @tparam SpiHz The SPI clock in Hz
+template<uint8_t CsPin, uint32_t SpiHz = 4000000>
+class FastSPITransport : public internal::SPIClassTransport {
+public:
+    explicit FastSPITransport(SPIClass &spi = SPI) : SPIClassTransport(spi) { }
+
+    void begin() override {
+        pinMode(CsPin, OUTPUT);
+#ifdef portOutputRegister
+        _csPort = portOutputRegister(digitalPinToPort(CsPin));
+        _csMask = digitalPinToBitMask(CsPin);
+#endif
+        _spi.begin();
+    }
+
+    void select() override {
+        _spi.beginTransaction(SPISettings(SpiHz, MSBFIRST, SPI_MODE0));
+        writeCs(false);
+    }
+
+    void deselect() override {
+        writeCs(true);
+        _spi.endTransaction();
+    }
+
+private:
+    void writeCs(bool high) {
+#ifdef portOutputRegister
+# ifdef __AVR__
+        uint8_t sreg = SREG;
+        cli();
+# endif
+        if(high)
+            *_csPort |= _csMask;
+        else
+            *_csPort &= ~_csMask;
+# ifdef __AVR__
+        SREG = sreg;
+# endif
+#else
+        digitalWrite(CsPin, high ? HIGH : LOW);
+#endif
+    }
+
+#ifdef portOutputRegister
+    decltype(portOutputRegister(digitalPinToPort(CsPin))) _csPort{nullptr};
+    decltype(digitalPinToBitMask(CsPin)) _csMask{0};
+#endif
+};
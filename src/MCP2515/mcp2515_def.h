@@ -55,6 +55,7 @@ enum REGISTER : uint8_t {
   MCP_RXF2SIDL = 0x09,
   MCP_RXF2EID8 = 0x0A,
   MCP_RXF2EID0 = 0x0B,
+  MCP_BFPCTRL = 0x0C,
   MCP_CANSTAT = 0x0E,
   MCP_CANCTRL = 0x0F,
   MCP_RXF3SIDH = 0x10,
@@ -157,6 +158,18 @@ enum EFLG : uint8_t {
 static constexpr uint8_t CANSTAT_OPMOD = 0xE0;
 static constexpr uint8_t CANSTAT_ICOD = 0x0E;
 
+/// CANCTRL after a RESET instruction, it reads back once the oscillator is running
+static constexpr uint8_t CANCTRL_RESET = 0x87;
+
+/// Time the chip gets to come out of reset and to reach a requested mode
+static constexpr uint32_t RESET_TIMEOUT_MS = 10;
+static constexpr uint32_t MODE_TIMEOUT_MS = 10;
+
+static constexpr uint8_t BFPCTRL_B0BFM = 0x01;
+static constexpr uint8_t BFPCTRL_B1BFM = 0x02;
+static constexpr uint8_t BFPCTRL_B0BFE = 0x04;
+static constexpr uint8_t BFPCTRL_B1BFE = 0x08;
+
 static constexpr uint8_t CNF3_SOF = 0x80;
 static constexpr uint8_t CNF3_WAKFIL = 0x40;
 
@@ -193,87 +206,20 @@ enum STAT: uint8_t {
     STAT_RXIF_MASK = 0x03,
 };
 
-enum RXBn: uint8_t { RXB0 = 0, RXB1 };
-enum TXBn: uint8_t { TXB0 = 0, TXB1, TXB2 };
-
-struct mcp_baud_cfg {
-    bool set{false};
-    uint8_t cnf1{0};
-    uint8_t cnf2{0};
-    uint8_t cnf3{0};
+enum RXSTATUS: uint8_t {
+    RXSTATUS_FILHIT = 0x07,
+    RXSTATUS_RTR    = 0x08,
+    RXSTATUS_EXT    = 0x10,
+    RXSTATUS_RXB0   = 0x40,
+    RXSTATUS_RXB1   = 0x80,
 
-    constexpr mcp_baud_cfg() = default;
-    constexpr mcp_baud_cfg(uint8_t cnf1, uint8_t cnf2, uint8_t cnf3): set(true), cnf1(cnf1), cnf2(cnf2), cnf3(cnf3) { }
-
-    explicit operator bool() const {return set;}
+    RXSTATUS_RX_MASK = 0xC0,
 };
 
-/*
- * Speed 8M
- */
-static constexpr mcp_baud_cfg MCP_8MHZ_1000KBPS {0x00, 0x80, 0x80};
-static constexpr mcp_baud_cfg MCP_8MHZ_500KBPS  {0x00, 0x90, 0x82};
-static constexpr mcp_baud_cfg MCP_8MHZ_250KBPS  {0x00, 0xB1, 0x85};
-static constexpr mcp_baud_cfg MCP_8MHZ_200KBPS  {0x00, 0xB4, 0x86};
-static constexpr mcp_baud_cfg MCP_8MHZ_125KBPS  {0x01, 0xB1, 0x85};
-static constexpr mcp_baud_cfg MCP_8MHZ_100KBPS  {0x01, 0xB4, 0x86};
-static constexpr mcp_baud_cfg MCP_8MHZ_80KBPS   {0x01, 0xBF, 0x87};
-static constexpr mcp_baud_cfg MCP_8MHZ_50KBPS   {0x03, 0xB4, 0x86};
-static constexpr mcp_baud_cfg MCP_8MHZ_40KBPS   {0x03, 0xBF, 0x87};
-static constexpr mcp_baud_cfg MCP_8MHZ_33K3BPS  {0x47, 0xE2, 0x85};
-static constexpr mcp_baud_cfg MCP_8MHZ_31K25BPS {0x07, 0xA4, 0x84};
-static constexpr mcp_baud_cfg MCP_8MHZ_20KBPS   {0x07, 0xBF, 0x87};
-static constexpr mcp_baud_cfg MCP_8MHZ_10KBPS   {0x0F, 0xBF, 0x87};
-static constexpr mcp_baud_cfg MCP_8MHZ_5KBPS    {0x1F, 0xBF, 0x87};
+/// RX STATUS filter codes 6 and 7 are RXF0 and RXF1 rolled over into RXB1
+static constexpr uint8_t RXSTATUS_FILHIT_ROLLOVER = 6;
 
-/*
- * Speed 12M
- */
-static constexpr mcp_baud_cfg MCP_12MHZ_1000KBPS {0x00, 0x88, 0x81};
-static constexpr mcp_baud_cfg MCP_12MHZ_500KBPS  {0x00, 0x9B, 0x82};
-static constexpr mcp_baud_cfg MCP_12MHZ_250KBPS  {0x01, 0x9B, 0x82};
-static constexpr mcp_baud_cfg MCP_12MHZ_200KBPS  {0x01, 0xA4, 0xB3};
-static constexpr mcp_baud_cfg MCP_12MHZ_125KBPS  {0x03, 0x9B, 0x82};
-static constexpr mcp_baud_cfg MCP_12MHZ_100KBPS  {0x03, 0xA4, 0x83};
-static constexpr mcp_baud_cfg MCP_12MHZ_80KBPS   {0x04, 0xA4, 0x83};
-static constexpr mcp_baud_cfg MCP_12MHZ_50KBPS   {0x07, 0xA4, 0x83};
-static constexpr mcp_baud_cfg MCP_12MHZ_40KBPS   {0x09, 0xA4, 0x83};
-static constexpr mcp_baud_cfg MCP_12MHZ_33K3BPS  {0x0E, 0xB6, 0x84};
-static constexpr mcp_baud_cfg MCP_12MHZ_20KBPS   {0x07, 0xBF, 0x84};
-static constexpr mcp_baud_cfg MCP_12MHZ_10KBPS   {0x31, 0x9B, 0x82};
-static constexpr mcp_baud_cfg MCP_12MHZ_5KBPS    {0x3B, 0xB6, 0x84};
-
-/*
- *  speed 16M
- */
-static constexpr mcp_baud_cfg MCP_16MHZ_1000KBPS    {0x00, 0xD0, 0x82};
-static constexpr mcp_baud_cfg MCP_16MHZ_500KBPS     {0x00, 0xF0, 0x86};
-static constexpr mcp_baud_cfg MCP_16MHZ_250KBPS     {0x41, 0xF1, 0x85};
-static constexpr mcp_baud_cfg MCP_16MHZ_200KBPS     {0x01, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_125KBPS     {0x03, 0xF0, 0x86};
-static constexpr mcp_baud_cfg MCP_16MHZ_100KBPS     {0x03, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_80KBPS      {0x03, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_83K3BPS     {0x03, 0xBE, 0x07};
-static constexpr mcp_baud_cfg MCP_16MHZ_50KBPS      {0x07, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_40KBPS      {0x07, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_33K3BPS     {0x4E, 0xF1, 0x85};
-static constexpr mcp_baud_cfg MCP_16MHZ_20KBPS      {0x0F, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_10KBPS      {0x1F, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_16MHZ_5KBPS       {0x3F, 0xFF, 0x87};
-
-/*
- *  speed 20M
- */
-static constexpr mcp_baud_cfg MCP_20MHZ_1000KBPS    {0x00, 0xD9, 0x82};
-static constexpr mcp_baud_cfg MCP_20MHZ_500KBPS     {0x00, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_250KBPS     {0x41, 0xFB, 0x86};
-static constexpr mcp_baud_cfg MCP_20MHZ_200KBPS     {0x01, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_125KBPS     {0x03, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_100KBPS     {0x04, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_83K3BPS     {0x04, 0xFE, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_80KBPS      {0x04, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_50KBPS      {0x09, 0xFA, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_40KBPS      {0x09, 0xFF, 0x87};
-static constexpr mcp_baud_cfg MCP_20MHZ_33K3BPS     {0x0B, 0xFF, 0x87};
+enum RXBn: uint8_t { RXB0 = 0, RXB1 };
+enum TXBn: uint8_t { TXB0 = 0, TXB1, TXB2 };
 
 } // namespace internal 